@@ -0,0 +1,301 @@
+/*** includes ***/
+
+// the editor core is compiled right into the harness so every static
+// helper and global is reachable without a terminal
+#define ZILO_NO_MAIN
+#include "zilo.c"
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+/*** defines ***/
+
+#define BENCH_ROWS 48   // text area of the virtual screen
+#define BENCH_COLS 160
+#define BENCH_FRAMES 2000 // frames drawn while paging through a file
+#define BENCH_EDITS 2000  // keystrokes applied at random positions
+#define BENCH_NEEDLE "zilo_bench_needle"
+
+enum benchKind
+{
+    BENCH_CODE,
+    BENCH_LONG,
+    BENCH_TABS,
+    BENCH_COMMENTS
+};
+
+/*** data ***/
+
+struct benchScenario
+{
+    const char *name;
+    enum benchKind kind;
+    long lines;
+};
+
+struct benchScenario scenarios[] = {
+    {"code-1k", BENCH_CODE, 1000},
+    {"code-10k", BENCH_CODE, 10000},
+    {"code-100k", BENCH_CODE, 100000},
+    {"code-1m", BENCH_CODE, 1000000},
+    {"code-10m", BENCH_CODE, 10000000},
+    {"long-lines", BENCH_LONG, 64},
+    {"tab-heavy", BENCH_TABS, 1000000},
+    {"comment-heavy", BENCH_COMMENTS, 1000000},
+};
+
+#define BENCH_SCENARIOS (int)(sizeof(scenarios) / sizeof(scenarios[0]))
+
+/*** timing ***/
+
+double benchNow()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+// xorshift so every run edits the same positions
+unsigned int bench_seed = 2463534242u;
+
+unsigned int benchRand()
+{
+    bench_seed ^= bench_seed << 13;
+    bench_seed ^= bench_seed >> 17;
+    bench_seed ^= bench_seed << 5;
+    return bench_seed;
+}
+
+/*** synthetic files ***/
+
+void benchWriteLine(FILE *fp, enum benchKind kind, long i)
+{
+    switch (kind)
+    {
+    case BENCH_CODE:
+        switch (i % 8)
+        {
+        case 0:
+            fprintf(fp, "int func_%ld(int a, char *s)\n", i);
+            break;
+        case 1:
+            fprintf(fp, "{\n");
+            break;
+        case 2:
+            fprintf(fp, "    // step %ld of the synthetic workload\n", i);
+            break;
+        case 3:
+            fprintf(fp, "    if (a > %ld && s != NULL)\n", i % 1000);
+            break;
+        case 4:
+            fprintf(fp, "        return printf(\"%%s: %%d\\n\", s, a + %ld);\n", i);
+            break;
+        case 5:
+            fprintf(fp, "    double x = %ld.5 * a;\n", i % 97);
+            break;
+        case 6:
+            fprintf(fp, "    return (int)x;\n");
+            break;
+        default:
+            fprintf(fp, "}\n");
+            break;
+        }
+        break;
+    case BENCH_LONG:
+        // each row is about a megabyte of tokens
+        for (int j = 0; j < 40000; j++)
+            fprintf(fp, "x%d = \"s\"; ", j % 1000);
+        fprintf(fp, "// %ld\n", i);
+        break;
+    case BENCH_TABS:
+        fprintf(fp, "\t\tcase %ld:\t\tv\t= %ld;\t// tab\tstop\n", i, i % 31);
+        break;
+    case BENCH_COMMENTS:
+        if (i % 16 == 0)
+            fprintf(fp, "/* block comment %ld opens\n", i);
+        else if (i % 16 == 7)
+            fprintf(fp, "   and closes */ int v%ld = %ld;\n", i, i);
+        else if (i % 2)
+            fprintf(fp, "   * comment body line %ld with \"quotes\" and 42\n", i);
+        else
+            fprintf(fp, "// line comment %ld\n", i);
+        break;
+    }
+}
+
+// write the scenario's file into a temporary .c so syntax highlighting applies
+char *benchGenerate(struct benchScenario *sc, long *bytes)
+{
+    char *path = strdup("/tmp/zilo-bench-XXXXXX.c");
+    int fd = mkstemps(path, 2);
+    if (fd == -1)
+        die("mkstemps");
+    FILE *fp = fdopen(fd, "w");
+    if (!fp)
+        die("fdopen");
+
+    for (long i = 0; i < sc->lines; i++)
+        benchWriteLine(fp, sc->kind, i);
+    fprintf(fp, "%s\n", BENCH_NEEDLE);
+
+    *bytes = ftell(fp);
+    fclose(fp);
+    return path;
+}
+
+/*** stages ***/
+
+// page down through the file, composing every frame the way the terminal would get it
+long benchDraw()
+{
+    long bytes = 0;
+    E.cx = 0;
+    E.cy = 0;
+    for (int i = 0; i < BENCH_FRAMES; i++)
+    {
+        struct abuf ab = ABUF_INIT;
+        editorDrawScreen(&ab);
+        bytes += ab.len;
+        abFree(&ab);
+
+        E.cy += E.screenrows;
+        if (E.numrows <= E.cy)
+            E.cy = 0;
+        E.cx = E.row[E.cy].size / 2;
+    }
+    return bytes;
+}
+
+void benchEdit()
+{
+    static const char keys[] = "abc xyz/*\"\t";
+    for (int i = 0; i < BENCH_EDITS; i++)
+    {
+        E.cy = benchRand() % E.numrows;
+        E.cx = E.row[E.cy].size ? benchRand() % E.row[E.cy].size : 0;
+        int r = benchRand() % 16;
+        if (r == 0)
+            editorInsertNewline();
+        else if (r < 4)
+            editorDelChar();
+        else
+            editorInsertChar(keys[benchRand() % (sizeof(keys) - 1)]);
+
+        // keep the view on the cursor like the main loop does
+        editorScroll();
+    }
+}
+
+// search from the top for the needle on the last line, returns whether it was hit
+int benchFind()
+{
+    E.cx = 0;
+    E.cy = 0;
+    editorFindCallback(BENCH_NEEDLE, 0);
+    int found = E.match_row != -1;
+    editorFindCallback(BENCH_NEEDLE, '\r');
+    return found;
+}
+
+/*** scenarios ***/
+
+// runs in a forked child so peak RSS is per scenario; prints the timing
+// fields and returns whether the needle every fixture ends with was found
+int benchRun(struct benchScenario *sc)
+{
+    double t, gen, open, draw, edit, find, save;
+    long bytes;
+    int found;
+
+    initEditorSize(BENCH_ROWS, BENCH_COLS);
+
+    t = benchNow();
+    char *path = benchGenerate(sc, &bytes);
+    gen = benchNow() - t;
+
+    t = benchNow();
+    editorOpen(path);
+    open = benchNow() - t;
+
+    t = benchNow();
+    long frame_bytes = benchDraw();
+    draw = benchNow() - t;
+
+    // find before the edits, which may land on the needle's row
+    t = benchNow();
+    found = benchFind();
+    find = benchNow() - t;
+
+    t = benchNow();
+    benchEdit();
+    edit = benchNow() - t;
+
+    t = benchNow();
+    editorSave();
+    save = benchNow() - t;
+
+    unlink(path);
+    free(path);
+
+    printf("\"bytes\": %ld, \"generate_ms\": %.3f, \"open_ms\": %.3f, "
+           "\"draw_ms\": %.3f, \"frames\": %d, \"bytes_per_frame\": %.1f, "
+           "\"edit_ms\": %.3f, \"edits\": %d, "
+           "\"find_ms\": %.3f, \"found\": %s, \"save_ms\": %.3f, ",
+           bytes, gen, open,
+           draw, BENCH_FRAMES, (double)frame_bytes / BENCH_FRAMES,
+           edit, BENCH_EDITS, find, found ? "true" : "false", save);
+    fflush(stdout);
+    return found;
+}
+
+int benchSelected(struct benchScenario *sc, int argc, char *argv[])
+{
+    if (argc < 2)
+        return 1;
+    for (int i = 1; i < argc; i++)
+        if (strncmp(sc->name, argv[i], strlen(argv[i])) == 0)
+            return 1;
+    return 0;
+}
+
+/*** init ***/
+
+// usage: zilo-bench [scenario-prefix...], results go to stdout as JSON and
+// the exit status is 1 if any scenario failed
+int main(int argc, char *argv[])
+{
+    int first = 1;
+    int failed = 0;
+
+    printf("{\"version\": \"%s\", \"scenarios\": [\n", ZILO_VERSION);
+    fflush(stdout);
+    for (int i = 0; i < BENCH_SCENARIOS; i++)
+    {
+        if (!benchSelected(&scenarios[i], argc, argv))
+            continue;
+        printf("%s    {\"name\": \"%s\", \"lines\": %ld, ",
+               first ? "" : ",\n", scenarios[i].name, scenarios[i].lines);
+        fflush(stdout);
+        first = 0;
+
+        pid_t pid = fork();
+        if (pid == -1)
+            die("fork");
+        if (pid == 0)
+            exit(benchRun(&scenarios[i]) ? 0 : 1);
+
+        int status;
+        struct rusage ru;
+        if (wait4(pid, &status, 0, &ru) == -1)
+            die("wait4");
+        printf("\"exit_status\": %d, \"peak_rss_kb\": %ld}",
+               WIFEXITED(status) ? WEXITSTATUS(status) : -1, ru.ru_maxrss);
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        {
+            fprintf(stderr, "zilo-bench: %s failed, the needle wasn't found or it crashed\n", scenarios[i].name);
+            failed = 1;
+        }
+    }
+    printf("\n]}\n");
+    return failed;
+}
@@ -1,5 +1,305 @@
-#include <bits/stdc++.h>
+/*** includes ***/
 
-int main() {
+// like the benchmarks, the editor core is compiled into the test binary
+#define ZILO_NO_MAIN
+#include "zilo.c"
+
+/*** harness ***/
+
+int test_failures = 0;
+
+#define CHECK(cond)                                                           \
+    do                                                                        \
+    {                                                                         \
+        if (!(cond))                                                          \
+        {                                                                     \
+            fprintf(stderr, "%s:%d: %s failed\n", __FILE__, __LINE__, #cond); \
+            test_failures++;                                                  \
+        }                                                                     \
+    } while (0)
+
+// an empty buffer holding lines
+void testLoad(const char **lines, int n)
+{
+    editorFreeRows();
+    for (int i = 0; i < n; i++)
+        editorInsertRow(E.numrows, (char *)lines[i], strlen(lines[i]));
+}
+
+// whether the buffer holds exactly lines
+int testRows(const char **lines, int n)
+{
+    if (E.numrows != n)
+        return 0;
+    for (int i = 0; i < n; i++)
+        if (E.row[i].size != (int)strlen(lines[i]) || memcmp(E.row[i].chars, lines[i], E.row[i].size) != 0)
+            return 0;
+    return 1;
+}
+
+/*** sort ***/
+
+// integers past 2^53 share a double, so only their digits tell them apart
+void testSortBigNumbers()
+{
+    const char *in[] = {"9007199254740993", "12345678901234567891", "9007199254740992",
+                        "12345678901234567890", "9007199254740992", "-9007199254740993",
+                        "-9007199254740992"};
+    const char *sorted[] = {"-9007199254740993", "-9007199254740992", "9007199254740992",
+                            "9007199254740992", "9007199254740993", "12345678901234567890",
+                            "12345678901234567891"};
+    testLoad(in, 7);
+    editorSortRows(0, E.numrows - 1, SORT_NUMERIC);
+    CHECK(testRows(sorted, 7));
+
+    const char *unique[] = {"-9007199254740993", "-9007199254740992", "9007199254740992",
+                            "9007199254740993", "12345678901234567890", "12345678901234567891"};
+    testLoad(in, 7);
+    editorSortRows(0, E.numrows - 1, SORT_NUMERIC | SORT_UNIQUE);
+    CHECK(testRows(unique, 6));
+
+    const char *reversed[] = {"12345678901234567891", "12345678901234567890", "9007199254740993",
+                              "9007199254740992", "-9007199254740992", "-9007199254740993"};
+    testLoad(in, 7);
+    editorSortRows(0, E.numrows - 1, SORT_NUMERIC | SORT_REVERSE | SORT_UNIQUE);
+    CHECK(testRows(reversed, 6));
+}
+
+// numbers that are equal however they're written are repeats
+void testSortEqualNumbers()
+{
+    const char *in[] = {"12.50 b", "-0", "12.5 a", "0", "0012.5", "x"};
+    const char *unique[] = {"-0", "12.50 b"};
+    testLoad(in, 6);
+    editorSortRows(0, E.numrows - 1, SORT_NUMERIC | SORT_UNIQUE);
+    CHECK(testRows(unique, 2));
+}
+
+/*** soft wrap ***/
+
+// a wide char that would straddle the right edge starts the next line, and
+// the height, the drawing and the cursor all agree on where that line starts
+void testWrapWideChar()
+{
+    const char *lines[] = {"a一二三四五Z"};
+    testLoad(lines, 1);
+    E.screencols = 10;
+    editorWrapToggle();
+
+    CHECK(wrap.height[0] == 2);
+    CHECK(editorWrapStart(0, 1) == 9);
+
+    struct abuf ab = ABUF_INIT;
+    E.rowoff = 0;
+    E.segoff = 0;
+    editorDrawRows(&ab);
+    CHECK(memmem(ab.b, ab.len, "a一二三四\x1b", strlen("a一二三四\x1b")) != NULL);
+    CHECK(memmem(ab.b, ab.len, "五Z", strlen("五Z")) != NULL);
+    abFree(&ab);
+
+    E.cy = 0;
+    E.cx = E.row[0].size - 1; // the Z
+    CHECK(editorWrapCursor() == 1);
+    E.cx = 10; // 四 on the first line, down lands on the second
+    editorWrapGoto(editorWrapCursor() + 1);
+    CHECK(E.cy == 0 && editorWrapLine(0, editorRowCxToRx(&E.row[0], E.cx)) == 1);
+
+    editorWrapToggle();
+    E.screencols = 80;
+}
+
+/*** editing ***/
+
+// backspace takes a whole multibyte char in one edit, never leaving a
+// partial sequence in the row
+void testDelMultibyte()
+{
+    const char *lines[] = {"a\xc3\xa9\xe4\xb8\x80"};
+    testLoad(lines, 1);
+    E.cy = 0;
+    E.cx = E.row[0].size;
+    E.dirty = 0;
+    editorDelChar();
+    const char *one[] = {"a\xc3\xa9"};
+    CHECK(testRows(one, 1) && E.cx == 3 && E.dirty == 1);
+    editorDelChar();
+    const char *two[] = {"a"};
+    CHECK(testRows(two, 1) && E.cx == 1 && E.dirty == 2);
+}
+
+// pressing Ctrl-N again swaps the completion for the next one
+void testCompleteCycle()
+{
+    const char *lines[] = {"alpha alpha alps", "al"};
+    testLoad(lines, 2);
+    E.cy = 1;
+    E.cx = 2;
+    editorComplete();
+    const char *first[] = {"alpha alpha alps", "alpha"};
+    CHECK(testRows(first, 2) && E.cx == 5);
+    editorComplete();
+    const char *second[] = {"alpha alpha alps", "alps"};
+    CHECK(testRows(second, 2) && E.cx == 4);
+}
+
+/*** follow ***/
+
+// saving a followed file mustn't read our own write back as new lines, and
+// a truncation mustn't reload over unsaved edits
+void testFollowSave()
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/zilo-test-%d.log", (int)getpid());
+    FILE *fp = fopen(path, "w");
+    fputs("one\ntwo\nthree\n", fp);
+    fclose(fp);
+
+    editorFreeRows();
+    editorOpen(path);
+    editorFollow(path);
+    E.cy = 0;
+    E.cx = 0;
+    editorInsertChar('X');
+    editorInsertChar('X');
+    editorInsertNewline();
+    editorSave();
+    editorFollowCheck();
+    const char *saved[] = {"XX", "one", "two", "three"};
+    CHECK(testRows(saved, 4));
+    CHECK(E.dirty == 0);
+
+    fp = fopen(path, "a");
+    fputs("four\n", fp);
+    fclose(fp);
+    editorFollowCheck();
+    const char *grown[] = {"XX", "one", "two", "three", "four"};
+    CHECK(testRows(grown, 5));
+
+    E.cy = 0;
+    E.cx = 0;
+    editorInsertChar('Y');
+    CHECK(truncate(path, 0) == 0);
+    editorFollowCheck();
+    const char *kept[] = {"YXX", "one", "two", "three", "four"};
+    CHECK(testRows(kept, 5));
+    CHECK(E.dirty);
+
+    close(follow.fd);
+    close(follow.file);
+    follow.fd = -1;
+    follow.file = -1;
+    unlink(path);
+}
+
+/*** completion ***/
+
+// the viewer keeps no E.row, so a typed letter must neither go in nor be
+// looked up for a hint; the child dies on a segfault if it is
+void testViewerHint()
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/zilo-test-%d.txt", (int)getpid());
+    FILE *fp = fopen(path, "w");
+    fputs("alpha\nalphabet\n", fp);
+    fclose(fp);
+
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        editorFreeRows();
+        editorView(path, 1 << 20);
+        E.dirty = 0;
+        E.cy = 0;
+        E.cx = 3;
+        editorInsertChar('a');
+        editorCompleteHint();
+        _exit(E.dirty != 0);
+    }
+    int status;
+    waitpid(pid, &status, 0);
+    unlink(path);
+    CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+}
+
+/*** server ***/
+
+// a client that goes away with part of a frame unread resets the socket;
+// the server must hand the screen to the next client with its edits intact
+void testServerReset()
+{
+    const char *lines[] = {"unsaved", "edits"};
+    testLoad(lines, 2);
+    E.dirty = 1;
+
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/zilo-test-%d.sock", (int)getpid());
+    struct sockaddr_un addr = {0};
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+    unlink(path);
+    server.fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    CHECK(bind(server.fd, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+    CHECK(listen(server.fd, 8) == 0);
+    signal(SIGPIPE, SIG_IGN);
+
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        // the first client takes a few bytes of its first frame and drops
+        // the rest; the second sends a key and waits to be let go
+        char buf[16];
+        close(server.fd); // a server that died must not keep us queued
+        int fd = editorServerConnect(path);
+        dprintf(fd, "zilo 24 80\n");
+        read(fd, buf, sizeof(buf));
+        close(fd);
+        fd = editorServerConnect(path);
+        dprintf(fd, "zilo 24 80\na");
+        while (read(fd, buf, sizeof(buf)) > 0)
+            ;
+        _exit(0);
+    }
+
+    int in = dup(STDIN_FILENO), out = dup(STDOUT_FILENO);
+    editorServerAccept();
+    int c = editorReadKey();
+    int attached = server.attached;
+    editorServerDetach();
+    dup2(in, STDIN_FILENO);
+    dup2(out, STDOUT_FILENO);
+    close(in);
+    close(out);
+    waitpid(pid, NULL, 0);
+    close(server.fd);
+    server.fd = -1;
+    unlink(path);
+
+    CHECK(c == 'a');
+    CHECK(attached);
+    CHECK(testRows(lines, 2));
+    CHECK(E.dirty);
+}
+
+/*** init ***/
+
+int main()
+{
+    initEditorSize(24, 80);
+
+    testSortBigNumbers();
+    testSortEqualNumbers();
+    testWrapWideChar();
+    testDelMultibyte();
+    testCompleteCycle();
+    testFollowSave();
+    testViewerHint();
+    testServerReset();
+
+    if (test_failures)
+    {
+        fprintf(stderr, "%d checks failed\n", test_failures);
+        return 1;
+    }
+    printf("all tests passed\n");
     return 0;
 }
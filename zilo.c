@@ -5,14 +5,32 @@
 #define _GNU_SOURCE
 
 #include <ctype.h>
+#include <dirent.h>
 #include <errno.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 #include <fcntl.h>
+#include <limits.h>
+#include <malloc.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/inotify.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <sys/wait.h>
 #include <termios.h>
 #include <time.h>
 #include <unistd.h>
@@ -23,6 +41,39 @@
 #define ZILO_TAB_STOP 8
 #define ZILO_QUIT_TIMES 3
 
+#define ZILO_SLAB_MIN_SHIFT 4         // smallest slab size class: 16 bytes
+#define ZILO_SLAB_CLASSES 8           // largest slab size class: 2048 bytes
+#define ZILO_SLAB_CHUNK (64 * 1024)   // slab blocks are carved from chunks of this size
+#define ZILO_ARENA_CHUNK (1024 * 1024) // rows loaded from disk are packed into chunks of this size
+
+#define ZILO_LONG_LINE (64 * 1024) // rows this long only render the columns around the view
+#define ZILO_LONG_MARGIN 1024      // columns rendered on each side of the view
+#define ZILO_LEX_STEP (16 * 1024)  // chars between lexer checkpoints on long rows
+
+#define ZILO_PERF_RING 128 // frames in the overlay's rolling histogram
+#define ZILO_PERF_BUCKETS 9
+
+#define ZILO_VIEW_BLOCK 512 // lines per block in the viewer's row cache and line index
+#define ZILO_INDEX_MIN (16 * 1024 * 1024) // files this big get their line index saved beside them
+#define ZILO_INDEX_HASH (64 * 1024)       // bytes hashed at each end of the file to validate it
+#define ZILO_STREAM_SLICE (1024 * 1024)   // decoded bytes taken per wakeup before keys get a turn
+
+#define ZILO_WORD_MIN 3      // shorter words aren't worth completing
+#define ZILO_WORD_MAX 64     // longer runs of word chars are left out of the trie
+#define ZILO_COMPLETE_MAX 8  // candidates Ctrl-N cycles through
+#define ZILO_OUTLINE_STEP 4096 // rows the outline worker scans before checking for keys
+#define ZILO_OUTLINE_PICKS 64  // best matches the outline picker cycles through
+#define ZILO_DIFF_COST 1024    // edits searched before a diff settles for a good enough split
+#define ZILO_DIFF_GUTTER 2     // columns of change markers left of the text
+#define ZILO_GREP_THREADS 16        // most workers a project search starts
+#define ZILO_GREP_HITS 100000       // hits a project search stops at
+#define ZILO_GREP_SMALL (64 * 1024) // files up to this size are read rather than mapped
+#define ZILO_GREP_TEXT 200          // bytes of a hit's line kept for the list
+#define ZILO_BINARY_PROBE 4096 // a NUL among a file's first bytes marks it binary
+#define ZILO_HEX_WIDTH 16      // most bytes a hex view line shows
+
+#define BRACKET_DIRTY 1 // minpre is never positive, so this marks a node to recompute
+
 #define CTRL_KEY(k) ((k)&0x1f) // bitwise-AND with 00011111
 
 enum editorKey
@@ -51,9 +102,34 @@ enum editorHighlight
     HL_MATCH
 };
 
+// what each tracked heap block is charged to
+enum memKind
+{
+    MEM_CHARS = 0,
+    MEM_RENDER,
+    MEM_HL,
+    MEM_STOPS, // tab stop index
+    MEM_LONG,  // long row windows and lexer checkpoints
+    MEM_ROWS,  // the E.row array
+    MEM_SEARCH,
+    MEM_PROMPT,
+    MEM_WRAP, // soft wrap line counts and their prefix sums
+    MEM_FOLD,
+    MEM_BRACKET, // bracket depth tree
+    MEM_WORDS,   // completion trie
+    MEM_OUTLINE, // symbol index
+    MEM_DIFF,    // row hashes and hunks of the diff view
+    MEM_KINDS
+};
+
 #define HL_HIGHLIGHT_NUMBERS (1 << 0)
 #define HL_HIGHLIGHT_STRINGS (1 << 1)
 
+#define SORT_NUMERIC (1 << 0) // by the number a line starts with, like sort -n
+#define SORT_REVERSE (1 << 1)
+#define SORT_UNIQUE (1 << 2)  // drop lines equal to the one kept before them
+#define SORT_KEEP (1 << 3)    // leave the order alone, so only repeats go
+
 /*** data ***/
 
 struct editorSyntax
@@ -67,14 +143,60 @@ struct editorSyntax
     int flags; // whether to highlight it (numbers of strings)
 };
 
+typedef struct hlspan // run of render chars sharing one highlight
+{
+    unsigned int len : 28;
+    unsigned int hl : 4; // enum editorHighlight
+} hlspan;
+
+#define HLSPAN_MAX ((1 << 28) - 1)
+
+typedef struct tabstop // a tab or non-ASCII char in chars and the render column just past it
+{
+    unsigned int cx : 31;
+    unsigned int mb : 1; // a non-ASCII char rather than a tab
+    int rx;
+} tabstop;
+
+struct lexState // everything the highlighter carries from one char to the next
+{
+    unsigned char in_string;    // quote char of the open string, or 0
+    unsigned char in_comment;   // inside a multi-line comment
+    unsigned char line_comment; // the rest of the line is a single-line comment
+    unsigned char prev_sep;     // the previous char separates tokens
+    unsigned char prev_hl;      // highlight of the previous char
+};
+
+struct lexCheckpoint
+{
+    int pos; // offset in chars
+    struct lexState st;
+};
+
+struct longRow // kept only for rows of ZILO_LONG_LINE chars or more
+{
+    int roff;     // render column of render[0]
+    int cx0, cx1; // chars expanded into render
+    int dirty;    // chars from here on must be lexed again, INT_MAX when clean
+    int nlx;
+    struct lexCheckpoint *lx; // lexer state every ZILO_LEX_STEP chars or so
+};
+
 typedef struct erow // editor row
 {
     int idx;
     int size;
+    int cap;        // capacity of chars, 0 when chars lives in the load arena
     int rsize;
+    int rcap;       // capacity of render when it doesn't alias chars
+    int nhl;        // number of highlight spans, 0 means all HL_NORMAL
+    int nts;        // number of tab stops
+    int nmb;        // how many of them are non-ASCII chars, 0 for ASCII rows
     char *chars;
-    char *render;
-    unsigned char *hl; // highlight: 0 - 255
+    char *render;   // aliases chars when the row has no tabs
+    hlspan *hl;     // run-length encoded highlight of render
+    tabstop *ts;    // tab stops sorted by cx, NULL when there are none
+    struct longRow *lr; // render only holds a window of long rows
     int hl_open_comment;
 } erow;
 
@@ -84,20 +206,442 @@ struct editorConfig
     int rx;
     int rowoff; // row offset
     int coloff; // col offset
+    int segoff; // wrapped line of row rowoff at the top of the screen
     int screenrows;
     int screencols;
     int numrows;
+    int rowcap; // allocated slots in row
     erow *row;
     int dirty;
     char *filename;
     char statusmsg[80];
     time_t statusmsg_time;
     struct editorSyntax *syntax;
+    int match_row; // search match drawn as HL_MATCH, -1 when none
+    int match_rx;
+    int match_len;
     struct termios orig_termios; // original terminal state
+    int nonblock;     // stdout is non-blocking and frames may queue in outbuf
+    int stdout_flags; // file status flags to restore on exit
+    char *outbuf;     // the frame the terminal hasn't taken all of yet
+    int outlen;
+    int outsent;
+    int stale; // a frame was skipped, the screen is behind the editor state
 };
 
 struct editorConfig E;
 
+// raw input captured by --record, or fed back by --replay with latency samples
+struct keyLog
+{
+    FILE *fp;          // recording destination, NULL when not recording
+    double start;      // when the recording started, in ms
+    char chunk[64];    // bytes that arrived together since the last read timeout
+    int nchunk;
+    double chunk_time; // when the first of them arrived
+
+    int replaying;
+    char *buf; // every recorded byte
+    int len;
+    int pos;
+    int *ends; // end offset in buf of each burst of input
+    int nends;
+    int cur;
+    int out; // the real stdout, frames go to /dev/null while replaying
+
+    double key_time; // when the key being handled was read
+    int key_pending;
+    double *process; // ms from reading a key to starting the next frame
+    double *frame;   // ms spent composing that frame
+    double *bytes;   // size of that frame
+    int nsamples;
+    int samplecap;
+};
+
+struct keyLog keylog;
+
+// running totals kept by the allocation helpers, see memory accounting
+struct memStats
+{
+    long bytes[MEM_KINDS]; // as handed out by the allocator, slack included
+    long blocks[MEM_KINDS];
+    long slab;      // bytes in slab chunks
+    long slab_used; // of which handed out as blocks
+    long arena;     // bytes in load arena chunks
+    long arena_used;
+};
+
+struct memStats mem;
+
+// tail -f state for --follow
+struct followState
+{
+    int fd;       // inotify instance watching the file, -1 when not following
+    int file;     // the file itself, read from offset on
+    off_t offset; // bytes of the file already in rows
+    int partial;  // the last row is still waiting for its newline
+};
+
+struct followState follow = {-1, -1, 0, 0};
+
+// a server keeps one file loaded and lends its screen to one client at a time
+struct serverState
+{
+    int fd;         // listening socket, -1 when not serving
+    int attached;   // a client holds stdin and stdout
+    char *path;     // the socket, removed on exit
+    int nline;
+    uint64_t *line; // hash of each screen line the client last got
+    int full;       // the next frame goes out whole
+    int lost;       // a read or write on the client failed, it is gone
+};
+
+struct serverState server = {-1, 0, NULL, 0, NULL, 1, 0};
+
+// an external compressor, picked by the magic bytes at the start of a file
+struct fileCodec
+{
+    char *name;
+    char *magic;
+    int magic_len;
+    char *decode[4]; // argv filtering stdin to stdout
+    char *encode[4];
+};
+
+struct fileCodec codecs[] = {
+    {"gzip", "\x1f\x8b", 2, {"gzip", "-dc", NULL}, {"gzip", "-c", NULL}},
+    {"zstd", "\x28\xb5\x2f\xfd", 4, {"zstd", "-dcq", NULL}, {"zstd", "-cq", NULL}},
+};
+
+#define CODECS (int)(sizeof(codecs) / sizeof(codecs[0]))
+
+// a compressed file decoding into rows while the editor runs
+struct streamState
+{
+    struct fileCodec *codec; // of the open file, NULL when it is plain; save uses it too
+    int fd;                  // decoder output, -1 once it is all in rows
+    pid_t pid;
+    int partial; // the last row is still waiting for its newline
+};
+
+struct streamState stream = {NULL, -1, -1, 0};
+
+// a run of ZILO_VIEW_BLOCK rows materialized by the viewer
+struct viewBlock
+{
+    int b; // block number, rows[0] is line b * ZILO_VIEW_BLOCK
+    int n;
+    erow *rows;
+    long bytes; // held by the rows, charged against the budget
+    struct viewBlock *prev; // towards the most recently used
+    struct viewBlock *next;
+};
+
+// --view state: the file stays on disk and E.row is unused
+struct viewState
+{
+    int fd; // the file being viewed, -1 outside the viewer
+    long budget;
+    long used;
+    int nblocks;
+    off_t *offsets;             // where each block starts, plus the file size
+    struct viewBlock **blocks;  // materialized block for each, or NULL
+    unsigned char *comment;     // whether each block starts inside a multi-line comment, as last seen
+    struct viewBlock *mru;
+    struct viewBlock *lru;
+};
+
+struct viewState view = {-1, 0, 0, 0, NULL, NULL, NULL, NULL, NULL};
+
+// where the screen lines of a row start once a wide char was pushed down
+struct wrapBreaks
+{
+    int n;    // screen lines of the row, folded or not
+    int rx[]; // render column each of them starts at
+};
+
+// soft wrap: how many screen lines each row takes, with a Fenwick tree of
+// them so the screen line of a row and the row at a screen line are O(log n)
+struct wrapState
+{
+    int enabled;
+    int width;   // columns per screen line the counts are for
+    int n;       // rows counted
+    int cap;
+    int *height; // screen lines of each row
+    int *tree;   // 1-based Fenwick tree over height
+    int stale;   // rows were inserted or deleted mid-buffer, tree needs a rebuild
+    struct wrapBreaks **breaks; // per row, NULL when its lines start every width columns
+};
+
+struct wrapState wrap = {0, 0, 0, 0, NULL, NULL, 0, NULL};
+
+// rows start + 1 to end are hidden under row start
+struct foldRange
+{
+    int start;
+    int end;
+};
+
+// folded ranges, disjoint and sorted, with a running count of the rows
+// they hide so screen rows and file rows map onto each other in O(log n)
+struct foldState
+{
+    int n;
+    int cap;
+    struct foldRange *r;
+    int *hidden; // rows hidden by the folds before r[i]
+};
+
+struct foldState fold = {0, 0, NULL, NULL};
+
+// bracket depth change across a row or a run of rows
+struct bracketNode
+{
+    int net;    // opened minus closed
+    int minpre; // lowest depth reached reading forward, BRACKET_DIRTY when unknown
+    int maxsuf; // highest net of any tail, what reading backward must get past
+};
+
+// segment tree of bracketNode over the rows, leaves at t[size + row]
+struct bracketState
+{
+    int n;
+    int size; // leaves, a power of two
+    struct bracketNode *t;
+    int stale; // rows were inserted or deleted mid-buffer, inner nodes need recombining
+    int *list; // cx of each bracket in the row last scanned
+    int listcap;
+    int mark_row[2]; // brackets drawn as HL_MATCH, -1 when none
+    int mark_rx[2];
+};
+
+struct bracketState bracket = {0, 0, NULL, 0, NULL, 0, {-1, -1}, {0, 0}};
+
+// one byte of the buffer's words, siblings kept in byte order
+struct wordNode
+{
+    int child; // first child, 0 when none since the root is nobody's child
+    int next;  // next sibling
+    int parent;
+    int count; // occurrences of the word ending here
+    int best;  // highest count in the subtree, what completions are ranked by
+    unsigned char c;
+};
+
+// best-first queue entry: a subtree keyed by its best, or the word at a node keyed by its count
+struct wordPick
+{
+    int key;
+    int node; // node * 2, plus 1 for the word itself
+};
+
+// word frequency trie over every row, node 0 is the root
+struct wordTrie
+{
+    int n;
+    int cap;
+    struct wordNode *node;
+    struct wordPick *heap;
+    int heapcap;
+};
+
+struct wordTrie words = {0, 0, NULL, NULL, 0};
+
+// what Ctrl-N put in last, so pressing it again swaps in the next candidate
+struct completeState
+{
+    int n; // candidates, 0 when not cycling
+    int pick;
+    int cy;
+    int start; // cx the prefix starts at
+    int plen;
+    int end;   // cx just after the inserted candidate
+    char cand[ZILO_COMPLETE_MAX][ZILO_WORD_MAX + 1];
+};
+
+struct completeState complete;
+
+enum outlineKind
+{
+    SYM_FUNCTION = 0,
+    SYM_STRUCT,
+    SYM_ENUM,
+    SYM_TYPE,
+    SYM_MACRO
+};
+
+// a definition whose name is len chars at cx of row
+struct outlineSym
+{
+    int row;
+    int cx;
+    unsigned char len;
+    unsigned char kind;
+};
+
+// rows start to end - 1 changed since they were scanned
+struct outlineRun
+{
+    int start;
+    int end;
+};
+
+// symbols of every row, sorted by row; a worker thread keeps them current
+// while the main thread waits for input, and only then
+struct outlineState
+{
+    int n;
+    int cap;
+    struct outlineSym *sym;
+    int scanned; // rows before this have had their first scan
+    int nrun;
+    int runcap;
+    struct outlineRun *run; // touched rows waiting for a rescan
+    char *code;             // scratch copy of a row with comments and strings blanked
+    int codecap;
+    int started;
+    int idle; // main thread is blocked on input, the worker may read rows
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    char prompt[80]; // the picker's prompt, rewritten as it moves
+};
+
+struct outlineState outline = {0, 0, NULL, 0, 0, 0, NULL, NULL, 0, 0, 0, 0,
+                               PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, {0}};
+
+// rows start to end - 1 replace del lines of the file on disk
+struct diffHunk
+{
+    int start;
+    int end;
+    int del;
+};
+
+// the buffer against the file on disk, as hashes of their lines
+struct diffState
+{
+    int enabled;
+    int n; // rows with a hash slot
+    int cap;
+    uint64_t *hash; // per row, 0 once the row changed until it's hashed again
+    int ndisk;      // lines of the file on disk, -1 until they're read
+    uint64_t *disk;
+    int nhunk;
+    int hunkcap;
+    struct diffHunk *hunk;
+    int stale; // rows changed since the hunks were found
+    int *v;    // furthest reach on each diagonal, forward then backward
+};
+
+struct diffState diff = {0, 0, 0, NULL, -1, NULL, 0, 0, NULL, 0, NULL};
+
+// a line holding the pattern in one of the files searched
+struct grepHit
+{
+    int file;
+    int line; // 1-based
+    int cx;
+    char *text; // the line, cut short and with control chars blanked
+};
+
+// project search: workers take paths off a shared stack, list directories
+// onto it and search files, appending hits while the main thread shows them
+struct grepState
+{
+    char *pattern;
+    int plen;
+    pthread_mutex_t lock;
+    pthread_cond_t work;
+    char **todo; // directories and files still to look at
+    int ntodo;
+    int todocap;
+    int busy; // workers holding a path
+    int stop;
+    int nthread;
+    pthread_t thread[ZILO_GREP_THREADS];
+    char **file; // files with hits
+    int nfile;
+    int filecap;
+    struct grepHit *hit;
+    int nhit;
+    int hitcap;
+    long searched; // files and bytes gone through
+    long bytes;
+    double start;
+    int wake[2]; // a byte tells the main thread there is news
+    int woken;   // that byte is in the pipe and not read yet
+    int listing; // the hit list is on screen
+    int sel;
+    int top;
+};
+
+struct grepState grep = {NULL, 0, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, NULL, 0, 0, 0, 0, 0, {0},
+                         NULL, 0, 0, NULL, 0, 0, 0, 0, 0, {-1, -1}, 0, 0, 0, 0};
+
+// hex view: the file mapped read-only, with a page made writable the first
+// time one of its bytes is overwritten and marked so saving writes it back
+struct hexState
+{
+    unsigned char *map; // NULL when the buffer is text
+    off_t size;
+    long pagesize;
+    unsigned char *dirty; // a bit per page, set while the page is writable
+    int readonly;         // the file can't be written
+    int digits;           // hex digits of the offset column
+    off_t cur;            // byte under the cursor
+    off_t top;            // first byte on screen
+    int nibble;           // the high half of cur was typed, the low one is next
+    int ascii;            // typing goes to the text column rather than the hex one
+    off_t match;          // first byte of the found pattern, -1 when none
+    int matchlen;
+};
+
+struct hexState hex = {NULL, 0, 0, NULL, 0, 0, 0, 0, 0, 0, -1, 0};
+
+enum perfStage
+{
+    PERF_SYNTAX = 0, // editorUpdateSyntax
+    PERF_ALLOC,      // growing row chars and E.row
+    PERF_ROWS,       // editorDrawRows
+    PERF_BARS,       // the rest of composing a frame
+    PERF_WRITE,      // handing the frame to the terminal
+    PERF_STAGES
+};
+
+// frame counters behind the Ctrl-P overlay and the --perf dump; they cost a
+// clock read per stage so nothing is measured until one of those asks
+struct perfStats
+{
+    int enabled;
+    int overlay;
+    char *dump; // file the totals go to on exit
+
+    double stage[PERF_STAGES]; // work done toward the frame being built
+    int reads;
+    int writes;
+
+    double last[PERF_STAGES]; // the last frame written
+    double last_frame;        // ms from the key being read to the frame being written
+    int last_bytes;
+    int last_reads;
+    int last_writes;
+    double ring[ZILO_PERF_RING];
+    long dropped; // frames skipped because the terminal was behind or keys were queued
+
+    long frames; // totals since startup
+    double total[PERF_STAGES];
+    double total_frame;
+    double max_frame;
+    long total_bytes;
+    long total_reads;
+    long total_writes;
+    long hist[ZILO_PERF_BUCKETS];
+};
+
+struct perfStats perf;
+
 /*** filetype ***/
 
 char *C_HL_extentions[] = {".c", ".h", ".cpp", ".hpp", NULL};
@@ -149,13 +693,40 @@ struct editorSyntax HLDB[] // HighLight DataBase
 /*** prototypes ***/
 
 void editorSetStatusMessage(const char *fmt, ...);
+int editorReadByte(char *c);
+double editorNow();
+void initEditorSize(int screenrows, int screencols);
 void editorRefreshScreen();
+void editorDrainOutput();
+int editorFollowCheck();
+int editorFoldHidden(int at);
+void editorBracketTouch(int at);
+void editorOutlineTouch(int at);
+void editorOutlineSplice(int at, int delta);
+void editorOutlineIdle(int idle);
+int editorStreamCheck();
+int editorGrepCheck();
+void editorHexSave();
+void editorServerAccept();
+void editorProcessKeypress();
+struct abuf;
+void editorServerDiff(struct abuf *ab);
 char *editorPrompt(char *prompt, void (*callback)(char *, int));
+int editorRowCxToRx(erow *row, int cx);
+int editorRowStopRx(erow *row, int i);
+int editorRowPrevChar(erow *row, int cx);
+int editorRowRxToCx(erow *row, int rx);
+int editorRowNextChar(erow *row, int cx);
+int editorRowExpand(erow *row, int cx0, int cx1, int col, char *out);
+int editorLexReach();
+int editorLongRelex(erow *row, struct lexState start);
+void editorLongHighlight(erow *row);
 
 /*** terminal ***/
 
 void die(const char *s)
 {
+    editorDrainOutput();
     write(STDOUT_FILENO, "\x1b[2J", 4);
     write(STDOUT_FILENO, "\x1b[H", 3);
 
@@ -165,6 +736,7 @@ void die(const char *s)
 
 void disableRawMode()
 {
+    editorDrainOutput();
     if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &E.orig_termios) == -1)
         die("tcsetattr");
 }
@@ -187,30 +759,125 @@ void enableRawMode()
         die("tcsetattr");
 }
 
+// Over a slow link a blocking write of a whole frame stalls the input loop
+// and every queued key then costs another full frame. With stdout
+// non-blocking the unsent tail of a frame waits in outbuf, no new frame is
+// composed until it is gone, and keys that arrive meanwhile are handled
+// without drawing; only the state after the last of them gets drawn.
+
+void enableNonblockingOutput()
+{
+    // stdin usually shares the tty's file description, so reads become
+    // non-blocking too and editorWaitInput stands in for VTIME
+    E.stdout_flags = fcntl(STDOUT_FILENO, F_GETFL);
+    if (E.stdout_flags != -1 &&
+        fcntl(STDOUT_FILENO, F_SETFL, E.stdout_flags | O_NONBLOCK) != -1)
+        E.nonblock = 1;
+}
+
+// write as much of outbuf as the terminal takes, returns 1 once it is all out
+int editorFlushOutput()
+{
+    while (E.outsent < E.outlen)
+    {
+        ssize_t n = write(STDOUT_FILENO, E.outbuf + E.outsent, E.outlen - E.outsent);
+        perf.writes++;
+        if (n == -1 && (errno == EAGAIN || errno == EINTR))
+            return 0;
+        if (n <= 0)
+        {
+            E.outsent = E.outlen; // the terminal is gone, nothing to wait for
+            if (server.attached)
+                server.lost = 1; // the next read hands the screen on
+            break;
+        }
+        E.outsent += n;
+    }
+    E.outlen = 0;
+    E.outsent = 0;
+    return 1;
+}
+
+// back to blocking writes with whatever frame was in flight sent in full
+void editorDrainOutput()
+{
+    if (!E.nonblock)
+        return;
+    E.nonblock = 0;
+    fcntl(STDOUT_FILENO, F_SETFL, E.stdout_flags);
+    editorFlushOutput();
+}
+
+int editorInputPending()
+{
+    struct pollfd pfd = {STDIN_FILENO, POLLIN, 0};
+    return poll(&pfd, 1, 0) == 1;
+}
+
+// wait up to ms for input, meanwhile feeding the terminal and drawing the
+// latest state once it has caught up; returns 0 on timeout
+int editorWaitInput(int ms)
+{
+    double deadline = editorNow() + ms;
+    while (1)
+    {
+        if (E.stale && E.outsent == E.outlen && !editorInputPending())
+            editorRefreshScreen();
+
+        // poll skips the inotify, decoder and grep entries while they are -1
+        struct pollfd fds[5] = {{STDIN_FILENO, POLLIN, 0}, {follow.fd, POLLIN, 0}, {stream.fd, POLLIN, 0},
+                                {grep.wake[0], POLLIN, 0}, {STDOUT_FILENO, POLLOUT, 0}};
+        int nfds = E.outsent < E.outlen ? 5 : 4;
+        int left = deadline - editorNow();
+        if (left < 0)
+            left = 0;
+        editorOutlineIdle(1);
+        int ready = poll(fds, nfds, left);
+        editorOutlineIdle(0);
+        if (ready == -1 && errno != EINTR)
+            die("poll");
+
+        if (fds[0].revents)
+            return 1; // readable, or an error that read will report
+        if (fds[1].revents && editorFollowCheck())
+            E.stale = 1;
+        if (fds[2].revents && editorStreamCheck())
+            E.stale = 1;
+        if (fds[3].revents && editorGrepCheck())
+            E.stale = 1;
+        if (nfds == 5 && fds[4].revents)
+            editorFlushOutput();
+        if (deadline <= editorNow())
+            return 0;
+    }
+}
+
 int editorReadKey()
 {
     int nread;
     char c;
-    while ((nread = read(STDIN_FILENO, &c, 1)) != 1)
+    while ((nread = editorReadByte(&c)) != 1)
     {
         if (nread == -1 && errno != EAGAIN)
             die("read");
     }
+    keylog.key_time = editorNow();
+    keylog.key_pending = 1;
 
     // read escape sequence
     if (c == '\x1b')
     {
         char seq[3];
-        if (read(STDIN_FILENO, &seq[0], 1) != 1)
+        if (editorReadByte(&seq[0]) != 1)
             return '\x1b';
-        if (read(STDIN_FILENO, &seq[1], 1) != 1)
+        if (editorReadByte(&seq[1]) != 1)
             return '\x1b';
 
         if (seq[0] == '[')
         {
             if ('0' <= seq[1] && seq[1] <= '9')
             {
-                if (read(STDIN_FILENO, &seq[2], 1) != 1)
+                if (editorReadByte(&seq[2]) != 1)
                     return '\x1b';
                 if (seq[2] == '~')
                 {
@@ -266,7 +933,7 @@ int editorReadKey()
     }
     else
     {
-        return c;
+        return (unsigned char)c;
     }
 }
 
@@ -319,610 +986,6625 @@ int getWindowSize(int *rows, int *cols)
     }
 }
 
-/*** syntax highlighting ***/
+/*** key log ***/
 
-int is_separator(int c)
+// A recording is a header line "zilo-keys 1 <rows> <cols>" followed by one
+// line per burst of input, "<ms since start> <hex bytes>". A burst is what
+// arrived before a read timed out, so escape sequences stay together and
+// a lone ESC stays a lone ESC when it is replayed.
+
+double editorNow()
 {
-    return isspace(c) || c == '\0' || strchr(",.()+-/*=~%<>[];", c) != NULL;
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
 }
 
-void editorUpdateSyntax(erow *row)
+void keylogFlush()
 {
-    row->hl = realloc(row->hl, row->rsize);
-    memset(row->hl, HL_NORMAL, row->rsize);
-
-    if (E.syntax == NULL)
+    if (keylog.fp == NULL || keylog.nchunk == 0)
         return;
+    fprintf(keylog.fp, "%.3f ", keylog.chunk_time - keylog.start);
+    for (int i = 0; i < keylog.nchunk; i++)
+        fprintf(keylog.fp, "%02x", (unsigned char)keylog.chunk[i]);
+    fputc('\n', keylog.fp);
+    fflush(keylog.fp);
+    keylog.nchunk = 0;
+}
 
-    char **keywords = E.syntax->keywords;
-
-    char *scs = E.syntax->singleline_comment_start;
-    char *mcs = E.syntax->multiline_comment_start;
-    char *mce = E.syntax->multiline_comment_end;
-
-    int scs_len = scs ? strlen(scs) : 0;
-    int mcs_len = mcs ? strlen(mcs) : 0;
-    int mce_len = mce ? strlen(mce) : 0;
-
-    int prev_sep = 1;
-    int in_string = 0;
-    int in_comment = (row->idx > 0 && E.row[row->idx - 1].hl_open_comment);
+void keylogRecord(const char *path)
+{
+    keylog.fp = fopen(path, "w");
+    if (!keylog.fp)
+        die("fopen");
+    fprintf(keylog.fp, "zilo-keys 1 %d %d\n", E.screenrows + 2, E.screencols);
+    keylog.start = editorNow();
+    atexit(keylogFlush);
+}
 
-    int i = 0;
-    while (i < row->rsize)
+// one read of up to a byte from the terminal, or from the recording when replaying
+int editorReadByte(char *c)
+{
+    if (keylog.replaying)
     {
-        char c = row->render[i];
-        unsigned char prev_hl = (0 < i) ? row->hl[i - 1] : HL_NORMAL;
-
-        if (scs_len && !in_string && !in_comment)
-        {
-            if (!strncmp(&row->render[i], scs, scs_len))
-            {
-                memset(&row->hl[i], HL_COMMENT, row->rsize - i);
-                break;
-            }
-        }
-
-        if (mcs_len && mce_len && !in_string)
-        {
-            if (in_comment)
-            {
-                row->hl[i] = HL_MLCOMMENT;
-                if (!strncmp(&row->render[i], mce, mce_len))
-                {
-                    memset(&row->hl[i], HL_MLCOMMENT, mce_len);
-                    i += mce_len;
-                    in_comment = 0;
-                    prev_sep = 1;
-                    continue;
-                }
-                else
-                {
-                    i++;
-                    continue;
-                }
-            }
-            else if (!strncmp(&row->render[i], mcs, mcs_len))
-            {
-                memset(&row->hl[i], HL_MLCOMMENT, mcs_len);
-                i += mcs_len;
-                in_comment = 1;
-                continue;
-            }
-        }
-
-        if (E.syntax->flags & HL_HIGHLIGHT_STRINGS)
+        if (keylog.cur == keylog.nends)
+            exit(0); // the report is printed from atexit
+        if (keylog.pos < keylog.ends[keylog.cur])
         {
-            if (in_string)
-            {
-                row->hl[i] = HL_STRING;
-                if (c == '\\' && i + 1 < row->rsize)
-                {
-                    row->hl[i + 1] = HL_STRING;
-                    i += 2;
-                    continue;
-                }
-
-                if (c == in_string)
-                    in_string = 0;
-                i++;
-                prev_sep = 1;
-                continue;
-            }
-            else
-            {
-                if (c == '"' || c == '\'')
-                {
-                    in_string = c;
-                    row->hl[i] = HL_STRING;
-                    i++;
-                    continue;
-                }
-            }
+            *c = keylog.buf[keylog.pos++];
+            return 1;
         }
+        keylog.cur++; // end of a burst reads like a timeout
+        return 0;
+    }
 
-        if (E.syntax->flags & HL_HIGHLIGHT_NUMBERS)
+    int nread = 0; // a wait that times out reads like a VTIME timeout
+    if (!E.nonblock || editorWaitInput(100))
+    {
+        editorOutlineIdle(!E.nonblock); // the VTIME wait is idle time too
+        nread = read(STDIN_FILENO, c, 1);
+        editorOutlineIdle(0);
+        if (nread == 0 && server.fd != -1)
+            server.lost = 1; // the client hung up
+        if (nread == -1 && errno != EAGAIN && errno != EINTR && server.fd != -1)
+            server.lost = 1; // or its connection was reset under us
+        perf.reads++;
+        if (nread == -1 && errno == EAGAIN)
+            nread = 0;
+        if (!E.nonblock && nread == 0 && editorFollowCheck())
+            editorRefreshScreen();
+        if (!E.nonblock && nread == 0 && editorGrepCheck())
+            editorRefreshScreen();
+    }
+    if (server.lost)
+    {
+        editorServerAccept(); // wait for the next client, the rows stay
+        nread = 0;
+    }
+    if (keylog.fp)
+    {
+        if (nread == 1)
         {
-            if ((isdigit(c) && (prev_sep || prev_hl == HL_NUMBER)) ||
-                (c == '.' && prev_hl == HL_NUMBER))
-            {
-                row->hl[i] = HL_NUMBER;
-                i++;
-                prev_sep = 0;
-                continue;
-            }
+            if (keylog.nchunk == 0)
+                keylog.chunk_time = editorNow();
+            keylog.chunk[keylog.nchunk++] = *c;
+            if (keylog.nchunk == sizeof(keylog.chunk))
+                keylogFlush();
         }
-
-        if (prev_sep)
+        else if (nread == 0)
         {
-            int j;
-            for (j = 0; keywords[j]; j++)
-            {
-                int klen = strlen(keywords[j]);
-                int kw2 = keywords[j][klen - 1] == '|';
-                if (kw2)
-                    klen--;
-                if (!strncmp(&row->render[i], keywords[j], klen) &&
-                    is_separator(row->render[i + klen]))
-                {
-                    memset(&row->hl[i], kw2 ? HL_KEYWORD2 : HL_KEYWORD1, klen);
-                    i += klen;
-                    break;
-                }
-            }
-            if (keywords[j] != NULL)
-            {
-                prev_sep = 0;
-                continue;
-            }
+            keylogFlush();
         }
-
-        prev_sep = is_separator(c);
-        i++;
     }
-
-    int changed = (row->hl_open_comment != in_comment);
-    row->hl_open_comment = in_comment;
-    if (changed && row->idx + 1 < E.numrows)
-        editorUpdateSyntax(&E.row[row->idx + 1]);
+    return nread;
 }
 
-int editorSyntaxToColor(int hl)
+void keylogSample(double process, double frame, int bytes)
 {
-    switch (hl)
+    if (keylog.nsamples == keylog.samplecap)
     {
-    case HL_COMMENT:
-    case HL_MLCOMMENT:
-        return 36; // cyan
-    case HL_KEYWORD1:
-        return 33; // yellow
-    case HL_KEYWORD2:
-        return 32; // green
-    case HL_STRING:
-        return 35; // magenta
-    case HL_NUMBER:
-        return 31; // red
-    case HL_MATCH:
-        return 34; // blue
-    default:
-        return 37;
+        keylog.samplecap = keylog.samplecap ? keylog.samplecap * 2 : 1024;
+        keylog.process = realloc(keylog.process, sizeof(double) * keylog.samplecap);
+        keylog.frame = realloc(keylog.frame, sizeof(double) * keylog.samplecap);
+        keylog.bytes = realloc(keylog.bytes, sizeof(double) * keylog.samplecap);
     }
+    keylog.process[keylog.nsamples] = process;
+    keylog.frame[keylog.nsamples] = frame;
+    keylog.bytes[keylog.nsamples] = bytes;
+    keylog.nsamples++;
 }
 
-void editorSelectSyntaxHighlight()
+int keylogCompare(const void *a, const void *b)
 {
-    E.syntax = NULL;
-    if (E.filename == NULL)
-        return;
-
-    char *ext = strrchr(E.filename, '.');
-
-    for (unsigned int j = 0; j < HLDB_ENTRIES; j++)
-    {
-        struct editorSyntax *s = &HLDB[j];
-        unsigned int i = 0;
-        while (s->filematch[i])
-        {
-            int is_ext = (s->filematch[i][0] == '.');
-            if ((is_ext && ext && !strcmp(ext, s->filematch[i])) ||
-                (!is_ext && strstr(E.filename, s->filematch[i])))
-            {
-                E.syntax = s;
-
-                int filerow;
-                for (filerow = 0; filerow < E.numrows; filerow++)
-                {
-                    editorUpdateSyntax(&E.row[filerow]);
-                }
-
-                return;
-            }
-            i++;
-        }
-    }
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
 }
 
-/*** row operations ***/
-
-int editorRowCxToRx(erow *row, int cx)
+// print p50/p99/max of samples as a JSON object, sorting them in place
+void keylogPercentiles(FILE *fp, const char *name, double *v, int n)
 {
-    int rx = 0;
-    int j;
-    for (j = 0; j < cx; j++)
-    {
-        if (row->chars[j] == '\t')
-        {
-            rx += (ZILO_TAB_STOP - 1) - (rx % ZILO_TAB_STOP);
-        }
-        rx++;
-    }
-    return rx;
+    double sum = 0;
+    for (int i = 0; i < n; i++)
+        sum += v[i];
+    qsort(v, n, sizeof(double), keylogCompare);
+    fprintf(fp, "  \"%s\": {\"p50\": %.4f, \"p99\": %.4f, \"max\": %.4f, \"mean\": %.4f}",
+            name, n ? v[n / 2] : 0, n ? v[(int)(n * 0.99)] : 0,
+            n ? v[n - 1] : 0, n ? sum / n : 0);
 }
 
-int editorRowRxToCx(erow *row, int rx)
+void keylogReport()
 {
-    int cur_rx = 0;
-    int cx;
-    for (cx = 0; cx < row->size; cx++)
-    {
-        if (row->chars[cx] == '\t')
-            cur_rx += (ZILO_TAB_STOP - 1) - (cur_rx % ZILO_TAB_STOP);
-        cur_rx++;
+    int n = keylog.nsamples;
+    double *total = malloc(sizeof(double) * (n + 1));
+    for (int i = 0; i < n; i++)
+        total[i] = keylog.process[i] + keylog.frame[i];
 
-        if (rx < cur_rx)
-            return cx;
-    }
-    return cx;
+    FILE *fp = fdopen(keylog.out, "w");
+    if (!fp)
+        return;
+    fprintf(fp, "{\n  \"keys\": %d,\n", n);
+    keylogPercentiles(fp, "process_ms", keylog.process, n);
+    fprintf(fp, ",\n");
+    keylogPercentiles(fp, "frame_ms", keylog.frame, n);
+    fprintf(fp, ",\n");
+    keylogPercentiles(fp, "total_ms", total, n);
+    fprintf(fp, ",\n");
+    keylogPercentiles(fp, "bytes_per_frame", keylog.bytes, n);
+    fprintf(fp, "\n}\n");
+    fclose(fp);
+    free(total);
 }
 
-void editorUpdateRow(erow *row)
+// load a recording and size the virtual screen like the terminal it came from
+void keylogReplay(const char *path)
 {
-    int tabs = 0;
-    int j;
-    for (j = 0; j < row->size; j++)
+    FILE *fp = fopen(path, "r");
+    if (!fp)
+        die("fopen");
+
+    int rows, cols;
+    if (fscanf(fp, "zilo-keys 1 %d %d\n", &rows, &cols) != 2)
     {
-        if (row->chars[j] == '\t')
-            tabs++;
+        errno = EINVAL;
+        die(path);
     }
 
-    free(row->render);
-    row->render = malloc(row->size + tabs * (ZILO_TAB_STOP - 1) + 1);
-
-    int idx = 0;
-    for (j = 0; j < row->size; j++)
+    char *line = NULL;
+    size_t linecap = 0;
+    int cap = 0;
+    while (getline(&line, &linecap, fp) != -1)
     {
-        if (row->chars[j] == '\t')
+        char *hex = strchr(line, ' ');
+        if (!hex)
+            continue;
+        int n = strspn(++hex, "0123456789abcdef") / 2;
+        keylog.buf = realloc(keylog.buf, keylog.len + n);
+        for (int i = 0; i < n; i++)
         {
-            row->render[idx++] = ' ';
-            while (idx % ZILO_TAB_STOP != 0)
-                row->render[idx++] = ' ';
+            unsigned int byte;
+            sscanf(&hex[i * 2], "%2x", &byte);
+            keylog.buf[keylog.len++] = byte;
         }
-        else
+        if (keylog.nends == cap)
         {
-            row->render[idx++] = row->chars[j];
+            cap = cap ? cap * 2 : 256;
+            keylog.ends = realloc(keylog.ends, sizeof(int) * cap);
         }
+        keylog.ends[keylog.nends++] = keylog.len;
     }
-    row->render[idx] = '\0';
-    row->rsize = idx;
-
-    editorUpdateSyntax(row);
-}
-
-void editorInsertRow(int at, char *s, size_t len)
-{
-    if (at < 0 || E.numrows < at)
-        return;
-
-    E.row = realloc(E.row, sizeof(erow) * (E.numrows + 1));
-    memmove(&E.row[at + 1], &E.row[at], sizeof(erow) * (E.numrows - at));
-    for (int j = at + 1; j <= E.numrows; j++)
-        E.row[j].idx++;
+    free(line);
+    fclose(fp);
 
-    E.row[at].idx = at;
+    // keep the real stdout for the report and send frames nowhere
+    keylog.out = dup(STDOUT_FILENO);
+    int null = open("/dev/null", O_WRONLY);
+    if (keylog.out == -1 || null == -1 || dup2(null, STDOUT_FILENO) == -1)
+        die("dup");
+    close(null);
 
-    E.row[at].size = len;
-    E.row[at].chars = malloc(len + 1);
-    memcpy(E.row[at].chars, s, len);
-    E.row[at].chars[len] = '\0';
+    keylog.replaying = 1;
+    initEditorSize(rows - 2, cols);
+    atexit(keylogReport);
+}
 
-    E.row[at].rsize = 0;
-    E.row[at].render = NULL;
-    E.row[at].hl = NULL;
-    E.row[at].hl_open_comment = 0;
-    editorUpdateRow(&E.row[at]);
+/*** perf counters ***/
 
-    E.numrows++;
-    E.dirty++;
-}
+// upper bounds in ms of all but the last histogram bucket
+const double perf_edges[ZILO_PERF_BUCKETS - 1] = {0.1, 0.25, 0.5, 1, 2, 4, 8, 16};
 
-void editorFreeRow(erow *row)
+double perfStart()
 {
-    free(row->render);
-    free(row->chars);
-    free(row->hl);
+    return perf.enabled ? editorNow() : 0;
 }
 
-void editorDelRow(int at)
+void perfStop(int stage, double start)
 {
-    if (at < 0 || E.numrows <= at)
-        return;
-
-    editorFreeRow(&E.row[at]);
-    memmove(&E.row[at], &E.row[at + 1], sizeof(erow) * (E.numrows - at - 1));
-    E.numrows--;
-    E.dirty++;
+    if (perf.enabled)
+        perf.stage[stage] += editorNow() - start;
 }
 
-void editorRowInsertChar(erow *row, int at, int c)
+int perfBucket(double ms)
 {
-    if (at < 0 || row->size < at)
-        at = row->size;
-    row->chars = realloc(row->chars, row->size + 2);
-    memmove(&row->chars[at + 1], &row->chars[at], row->size - at + 1);
-    for (int j = at; j < E.numrows - 1; j++)
-        E.row[j].idx--;
-    row->size++;
-    row->chars[at] = c;
-    editorUpdateRow(row);
-    E.dirty++;
+    int b = 0;
+    while (b < ZILO_PERF_BUCKETS - 1 && perf_edges[b] < ms)
+        b++;
+    return b;
 }
 
-void editorRowAppendString(erow *row, char *s, size_t len)
+// close the books on a frame that took ms and was bytes long
+void perfFrame(double ms, int bytes)
 {
-    row->chars = realloc(row->chars, row->size + len + 1);
-    memcpy(&row->chars[row->size], s, len); // append s to the row
-    row->size += len;
-    row->chars[row->size] = '\0';
-    editorUpdateRow(row);
-    E.dirty++;
+    for (int s = 0; s < PERF_STAGES; s++)
+    {
+        perf.last[s] = perf.stage[s];
+        perf.total[s] += perf.stage[s];
+        perf.stage[s] = 0;
+    }
+    perf.last_frame = ms;
+    perf.last_bytes = bytes;
+    perf.last_reads = perf.reads;
+    perf.last_writes = perf.writes;
+    perf.ring[perf.frames % ZILO_PERF_RING] = ms;
+
+    perf.frames++;
+    perf.total_frame += ms;
+    if (perf.max_frame < ms)
+        perf.max_frame = ms;
+    perf.total_bytes += bytes;
+    perf.total_reads += perf.reads;
+    perf.total_writes += perf.writes;
+    perf.hist[perfBucket(ms)]++;
+    perf.reads = 0;
+    perf.writes = 0;
 }
 
-void editorRowDelChar(erow *row, int at)
+void perfDump()
 {
-    if (at < 0 || row->size <= at)
+    FILE *fp = fopen(perf.dump, "w");
+    if (!fp)
         return;
-    memmove(&row->chars[at], &row->chars[at + 1], row->size - at);
-    row->size--;
-    editorUpdateRow(row);
-    E.dirty++;
+
+    static const char *names[PERF_STAGES] = {"syntax", "alloc", "rows", "bars", "write"};
+    long n = perf.frames ? perf.frames : 1;
+    fprintf(fp, "{\n  \"frames\": %ld,\n", perf.frames);
+    fprintf(fp, "  \"frame_ms\": {\"mean\": %.4f, \"max\": %.4f},\n",
+            perf.total_frame / n, perf.max_frame);
+    fprintf(fp, "  \"stage_ms\": {");
+    for (int s = 0; s < PERF_STAGES; s++)
+        fprintf(fp, "%s\"%s\": %.3f", s ? ", " : "", names[s], perf.total[s]);
+    fprintf(fp, "},\n");
+    fprintf(fp, "  \"bytes\": %ld,\n  \"bytes_per_frame\": %.1f,\n",
+            perf.total_bytes, (double)perf.total_bytes / n);
+    fprintf(fp, "  \"reads\": %ld,\n  \"writes\": %ld,\n  \"dropped\": %ld,\n",
+            perf.total_reads, perf.total_writes, perf.dropped);
+    fprintf(fp, "  \"histogram\": [");
+    for (int b = 0; b < ZILO_PERF_BUCKETS; b++)
+    {
+        if (b < ZILO_PERF_BUCKETS - 1)
+            fprintf(fp, "{\"le_ms\": %g, \"frames\": %ld}, ", perf_edges[b], perf.hist[b]);
+        else
+            fprintf(fp, "{\"le_ms\": null, \"frames\": %ld}", perf.hist[b]);
+    }
+    fprintf(fp, "]\n}\n");
+    fclose(fp);
 }
 
-/*** editor operations ***/
+/*** unicode ***/
+
+#define UTF8_INVALID 0xFFFFFFFFu
+
+// Codepoint ranges drawn two columns wide (East Asian Wide and Fullwidth)
+// or zero columns wide (combining marks and zero width spaces).
+const unsigned int wide_ranges[][2] = {
+    {0x1100, 0x115F}, {0x231A, 0x231B}, {0x2329, 0x232A}, {0x23E9, 0x23EC},
+    {0x23F0, 0x23F0}, {0x23F3, 0x23F3}, {0x25FD, 0x25FE}, {0x2614, 0x2615},
+    {0x2648, 0x2653}, {0x267F, 0x267F}, {0x2693, 0x2693}, {0x26A1, 0x26A1},
+    {0x26AA, 0x26AB}, {0x26BD, 0x26BE}, {0x26C4, 0x26C5}, {0x26CE, 0x26CE},
+    {0x26D4, 0x26D4}, {0x26EA, 0x26EA}, {0x26F2, 0x26F3}, {0x26F5, 0x26F5},
+    {0x26FA, 0x26FA}, {0x26FD, 0x26FD}, {0x2705, 0x2705}, {0x270A, 0x270B},
+    {0x2728, 0x2728}, {0x274C, 0x274C}, {0x274E, 0x274E}, {0x2753, 0x2755},
+    {0x2757, 0x2757}, {0x2795, 0x2797}, {0x27B0, 0x27B0}, {0x27BF, 0x27BF},
+    {0x2B1B, 0x2B1C}, {0x2B50, 0x2B50}, {0x2B55, 0x2B55}, {0x2E80, 0x303E},
+    {0x3041, 0x33FF}, {0x3400, 0x4DBF}, {0x4E00, 0x9FFF}, {0xA000, 0xA4CF},
+    {0xA960, 0xA97F}, {0xAC00, 0xD7A3}, {0xF900, 0xFAFF}, {0xFE10, 0xFE19},
+    {0xFE30, 0xFE6F}, {0xFF00, 0xFF60}, {0xFFE0, 0xFFE6}, {0x16FE0, 0x16FE4},
+    {0x17000, 0x18AFF}, {0x1B000, 0x1B2FF}, {0x1F004, 0x1F004}, {0x1F0CF, 0x1F0CF},
+    {0x1F18E, 0x1F18E}, {0x1F191, 0x1F19A}, {0x1F200, 0x1F202}, {0x1F210, 0x1F23B},
+    {0x1F240, 0x1F248}, {0x1F250, 0x1F251}, {0x1F260, 0x1F265}, {0x1F300, 0x1F64F},
+    {0x1F680, 0x1F6FF}, {0x1F7E0, 0x1F7EB}, {0x1F90C, 0x1F9FF}, {0x1FA70, 0x1FAFF},
+    {0x20000, 0x2FFFD}, {0x30000, 0x3FFFD},
+};
 
-void editorInsertChar(int c)
+const unsigned int zero_ranges[][2] = {
+    {0x0300, 0x036F}, {0x0483, 0x0489}, {0x0591, 0x05BD}, {0x0610, 0x061A},
+    {0x064B, 0x065F}, {0x0E31, 0x0E31}, {0x0E34, 0x0E3A}, {0x0E47, 0x0E4E},
+    {0x1AB0, 0x1AFF}, {0x1DC0, 0x1DFF}, {0x200B, 0x200F}, {0x20D0, 0x20FF},
+    {0x302A, 0x302D}, {0x3099, 0x309A}, {0xFE00, 0xFE0F}, {0xFE20, 0xFE2F},
+    {0xFEFF, 0xFEFF}, {0xE0100, 0xE01EF},
+};
+
+int unicodeInRanges(unsigned int cp, const unsigned int (*ranges)[2], int n)
 {
-    if (E.cy == E.numrows)
+    int lo = 0;
+    int hi = n - 1;
+    while (lo <= hi)
     {
-        editorInsertRow(E.numrows, "", 0);
+        int mid = (lo + hi) / 2;
+        if (cp < ranges[mid][0])
+            hi = mid - 1;
+        else if (ranges[mid][1] < cp)
+            lo = mid + 1;
+        else
+            return 1;
     }
-    editorRowInsertChar(&E.row[E.cy], E.cx, c); // insert a character at the current cursor position
-    E.cx++;
+    return 0;
 }
 
-void editorInsertNewline()
+// display columns of a codepoint; invalid bytes and controls show as one cell
+int unicodeWidth(unsigned int cp)
 {
-    if (E.cx == 0)
+    if (cp < 0x300 || cp == UTF8_INVALID)
+        return 1;
+    if (unicodeInRanges(cp, zero_ranges, sizeof(zero_ranges) / sizeof(zero_ranges[0])))
+        return 0;
+    if (unicodeInRanges(cp, wide_ranges, sizeof(wide_ranges) / sizeof(wide_ranges[0])))
+        return 2;
+    return 1;
+}
+
+// decode the char at s[0], returning its length in bytes; a malformed
+// sequence decodes as a single byte with *cp set to UTF8_INVALID
+int utf8Decode(const char *s, int len, unsigned int *cp)
+{
+    const unsigned char *u = (const unsigned char *)s;
+    if (u[0] < 0x80)
     {
-        editorInsertRow(E.cy, "", 0);
+        *cp = u[0];
+        return 1;
+    }
+
+    int n;
+    unsigned int c;
+    unsigned int min;
+    if ((u[0] & 0xE0) == 0xC0)
+    {
+        n = 2;
+        c = u[0] & 0x1F;
+        min = 0x80;
+    }
+    else if ((u[0] & 0xF0) == 0xE0)
+    {
+        n = 3;
+        c = u[0] & 0x0F;
+        min = 0x800;
+    }
+    else if ((u[0] & 0xF8) == 0xF0)
+    {
+        n = 4;
+        c = u[0] & 0x07;
+        min = 0x10000;
     }
     else
     {
-        erow *row = &E.row[E.cy];
-        editorInsertRow(E.cy + 1, &row->chars[E.cx], row->size - E.cx);
-        row = &E.row[E.cy];
-        row->size = E.cx;
-        row->chars[row->size] = '\0';
-        editorUpdateRow(row);
+        *cp = UTF8_INVALID;
+        return 1;
     }
-    E.cy++;
-    E.cx = 0;
+
+    if (len < n)
+    {
+        *cp = UTF8_INVALID;
+        return 1;
+    }
+    for (int j = 1; j < n; j++)
+    {
+        if ((u[j] & 0xC0) != 0x80)
+        {
+            *cp = UTF8_INVALID;
+            return 1;
+        }
+        c = (c << 6) | (u[j] & 0x3F);
+    }
+    if (c < min || 0x10FFFF < c || (0xD800 <= c && c <= 0xDFFF))
+    {
+        *cp = UTF8_INVALID;
+        return 1;
+    }
+    *cp = c;
+    return n;
 }
 
-void editorDelChar()
+// whether s[0..len) is plain ASCII, checking 16 (or 8) bytes at a time
+int isAscii(const char *s, int len)
 {
-    if (E.cy == E.numrows)
-        return;
-    if (E.cx == 0 && E.cy == 0)
-        return;
-
-    erow *row = &E.row[E.cy];
-    if (0 < E.cx)
+    int i = 0;
+#ifdef __SSE2__
+    for (; i + 16 <= len; i += 16)
     {
-        editorRowDelChar(row, E.cx - 1); // delete just left character of the cursor
-        E.cx--;
+        if (_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)&s[i])))
+            return 0;
     }
-    else
+#else
+    for (; i + 8 <= len; i += 8)
     {
-        E.cx = E.row[E.cy - 1].size;
-        editorRowAppendString(&E.row[E.cy - 1], row->chars, row->size);
-        editorDelRow(E.cy);
-        E.cy--;
+        uint64_t w;
+        memcpy(&w, &s[i], 8);
+        if (w & 0x8080808080808080ULL)
+            return 0;
+    }
+#endif
+    for (; i < len; i++)
+    {
+        if (s[i] & 0x80)
+            return 0;
     }
+    return 1;
 }
 
-/*** file i/o ***/
+/*** memory accounting ***/
 
-char *editorRowsToString(int *buflen)
-{
-    int totlen = 0;
-    int j;
-    for (j = 0; j < E.numrows; j++)
-        totlen += E.row[j].size + 1;
-    *buflen = totlen;
+const char *mem_names[MEM_KINDS] = {"chars", "render", "hl", "stops", "long", "rows", "search", "prompt", "wrap", "fold", "brackets", "words", "outline", "diff"};
 
-    char *buf = malloc(totlen);
-    char *p = buf;
-    for (j = 0; j < E.numrows; j++)
-    {
-        memcpy(p, E.row[j].chars, E.row[j].size);
-        p += E.row[j].size; // slide pointer p on buf by the length of the row
-        *p = '\n';
-        p++;
-    }
+void memTrack(int kind, long bytes, int blocks)
+{
+    mem.bytes[kind] += bytes;
+    mem.blocks[kind] += blocks;
+}
 
-    return buf;
+// realloc that charges the change in block size to kind
+void *memRealloc(int kind, void *p, size_t n)
+{
+    long old = malloc_usable_size(p);
+    void *np = realloc(p, n);
+    if (np == NULL && n != 0)
+        return NULL;
+    memTrack(kind, (long)malloc_usable_size(np) - old, (np != NULL) - (p != NULL));
+    return np;
 }
 
-void editorOpen(char *filename)
+void memFree(int kind, void *p)
 {
-    free(E.filename);
-    E.filename = strdup(filename);
+    if (p == NULL)
+        return;
+    memTrack(kind, -(long)malloc_usable_size(p), -1);
+    free(p);
+}
 
-    editorSelectSyntaxHighlight();
+// slab blocks on free lists and the unused tail of the arena
+long memIdle()
+{
+    return (mem.slab - mem.slab_used) + (mem.arena - mem.arena_used);
+}
 
-    FILE *fp = fopen(filename, "r");
-    if (!fp)
-        die("fopen");
+// rows loaded from disk are charged to chars through their arena chunks
+long memKindBytes(int kind)
+{
+    return mem.bytes[kind] + (kind == MEM_CHARS ? mem.arena : 0);
+}
 
-    char *line = NULL;
-    size_t linecap = 0;
-    ssize_t linelen;
+void editorShowMemory()
+{
+    long total = mem.slab - mem.slab_used;
+    for (int k = 0; k < MEM_KINDS; k++)
+        total += memKindBytes(k);
+    double pct = total ? 100.0 / total : 0;
+
+    editorSetStatusMessage("%.1fMB, %.1f B/line: chars %.0f%% render %.0f%% hl %.0f%% rows %.0f%% idle %.0f%%",
+                           total / 1048576.0, E.numrows ? (double)total / E.numrows : 0.0,
+                           memKindBytes(MEM_CHARS) * pct, mem.bytes[MEM_RENDER] * pct,
+                           mem.bytes[MEM_HL] * pct, mem.bytes[MEM_ROWS] * pct, memIdle() * pct);
+}
 
-    while ((linelen = getline(&line, &linecap, fp)) != -1)
+// full breakdown for --mem: what each kind holds against what the rows need
+void editorMemoryReport(FILE *fp)
+{
+    long used[MEM_KINDS] = {0};
+    long arena_live = 0;
+    for (int j = 0; j < E.numrows; j++)
     {
-        while (0 < linelen && (line[linelen - 1] == '\n' ||
-                               line[linelen - 1] == '\r'))
-            linelen--;
-
-        editorInsertRow(E.numrows, line, linelen);
+        erow *row = &E.row[j];
+        used[MEM_CHARS] += row->size + 1;
+        if (row->cap == 0)
+            arena_live += row->size + 1;
+        if (row->render != row->chars)
+            used[MEM_RENDER] += row->rsize + 1;
+        used[MEM_HL] += sizeof(hlspan) * row->nhl;
+        used[MEM_STOPS] += sizeof(tabstop) * row->nts;
+        if (row->lr)
+            used[MEM_LONG] += sizeof(struct longRow) + sizeof(struct lexCheckpoint) * row->lr->nlx;
+    }
+    used[MEM_ROWS] = sizeof(erow) * E.numrows;
+    used[MEM_SEARCH] = mem.bytes[MEM_SEARCH];
+    used[MEM_PROMPT] = mem.bytes[MEM_PROMPT];
+    used[MEM_WRAP] = wrap.enabled ? (sizeof(int) * 2 + sizeof(struct wrapBreaks *)) * wrap.n + sizeof(int) : 0;
+    for (int j = 0; j < wrap.n; j++)
+        if (wrap.breaks[j])
+            used[MEM_WRAP] += sizeof(struct wrapBreaks) + sizeof(int) * wrap.breaks[j]->n;
+    used[MEM_FOLD] = (sizeof(struct foldRange) + sizeof(int)) * fold.n;
+    used[MEM_BRACKET] = sizeof(struct bracketNode) * 2 * bracket.size + sizeof(int) * bracket.listcap;
+    used[MEM_WORDS] = sizeof(struct wordNode) * words.n;
+    used[MEM_OUTLINE] = sizeof(struct outlineSym) * outline.n + sizeof(struct outlineRun) * outline.nrun;
+    used[MEM_DIFF] = diff.enabled ? sizeof(uint64_t) * (diff.n + (0 < diff.ndisk ? diff.ndisk : 0)) + sizeof(struct diffHunk) * diff.nhunk +
+                                        sizeof(int) * 2 * (2 * ZILO_DIFF_COST + 3)
+                                  : 0;
+
+    long total = 0, payload = 0;
+    fprintf(fp, "%-8s %14s %10s %14s %14s\n", "kind", "allocated", "blocks", "used", "slack");
+    for (int k = 0; k < MEM_KINDS; k++)
+    {
+        long bytes = memKindBytes(k);
+        fprintf(fp, "%-8s %14ld %10ld %14ld %14ld\n",
+                mem_names[k], bytes, mem.blocks[k], used[k], bytes - used[k]);
+        total += bytes;
+        payload += used[k];
     }
+    total += mem.slab - mem.slab_used;
+    fprintf(fp, "total    %14ld bytes for %d lines, %.1f bytes/line\n",
+            total, E.numrows, E.numrows ? (double)total / E.numrows : 0.0);
+
+    fprintf(fp, "slab     %14ld bytes in chunks, %ld on free lists\n",
+            mem.slab, mem.slab - mem.slab_used);
+    fprintf(fp, "arena    %14ld bytes in chunks, %ld handed out, %ld not holding live rows\n",
+            mem.arena, mem.arena_used, mem.arena_used - arena_live);
+
+    struct mallinfo2 mi = mallinfo2();
+    fprintf(fp, "malloc   %14zu bytes from the system, %zu in use, %zu free\n",
+            mi.arena + mi.hblkhd, mi.uordblks + mi.hblkhd, mi.fordblks);
+    fprintf(fp, "fragmentation %.1f%% of tracked memory and %.1f%% of the heap hold no row data\n",
+            total ? 100.0 * (total - payload) / total : 0.0,
+            mi.arena + mi.hblkhd ? 100.0 * (mi.arena + mi.hblkhd - payload) / (mi.arena + mi.hblkhd) : 0.0);
+}
 
-    free(line);
-    fclose(fp);
-    E.dirty = 0;
+/*** row storage ***/
+
+// Row buffers come from power-of-two size classes so that a row grows in
+// place for most single-char inserts and freed blocks are reused by other
+// rows instead of fragmenting the heap. Buffers above the largest class
+// fall back to malloc with geometric growth. Rows read by editorOpen are
+// packed into a bump arena and only move to a slab once they are edited.
+
+struct slabBlock
+{
+    struct slabBlock *next;
+};
+
+struct slabBlock *slab_free[ZILO_SLAB_CLASSES];
+char *arena = NULL; // current arena chunk, its first bytes link to the previous chunk
+size_t arena_used = 0;
+size_t arena_size = 0;
+
+int slabClass(int n)
+{
+    int c = 0;
+    while (c < ZILO_SLAB_CLASSES && (1 << (c + ZILO_SLAB_MIN_SHIFT)) < n)
+        c++;
+    return c;
 }
 
-void editorSave()
+char *slabAlloc(int kind, int n, int *cap)
 {
-    if (E.filename == NULL)
+    int c = slabClass(n);
+    if (c == ZILO_SLAB_CLASSES)
     {
-        E.filename = editorPrompt("Save as: %s", NULL);
-        if (E.filename == NULL)
+        char *p = malloc(n);
+        if (p == NULL)
+            return NULL;
+        *cap = n;
+        memTrack(kind, n, 1);
+        return p;
+    }
+
+    int size = 1 << (c + ZILO_SLAB_MIN_SHIFT);
+    if (slab_free[c] == NULL)
+    {
+        char *chunk = malloc(ZILO_SLAB_CHUNK);
+        if (chunk == NULL)
+            return NULL;
+        mem.slab += ZILO_SLAB_CHUNK;
+        for (int off = ZILO_SLAB_CHUNK - size; 0 <= off; off -= size)
         {
-            editorSetStatusMessage("Save aborted");
-            return;
+            struct slabBlock *b = (struct slabBlock *)&chunk[off];
+            b->next = slab_free[c];
+            slab_free[c] = b;
         }
-        editorSelectSyntaxHighlight();
+    }
+
+    struct slabBlock *b = slab_free[c];
+    slab_free[c] = b->next;
+    *cap = size;
+    mem.slab_used += size;
+    memTrack(kind, size, 1);
+    return (char *)b;
+}
+
+void slabFree(int kind, char *p, int cap)
+{
+    if (p == NULL || cap == 0)
+        return;
+    memTrack(kind, -cap, -1);
+    int c = slabClass(cap);
+    if (c == ZILO_SLAB_CLASSES)
+    {
+        free(p);
+        return;
+    }
+    mem.slab_used -= cap;
+    struct slabBlock *b = (struct slabBlock *)p;
+    b->next = slab_free[c];
+    slab_free[c] = b;
+}
+
+// make room for n bytes, keeping the first len; *cap == 0 marks an arena block
+char *slabGrow(int kind, char *p, int len, int *cap, int n)
+{
+    if (n <= *cap)
+        return p;
+
+    int want = n;
+    if (0 < *cap && want < *cap + *cap / 2)
+        want = *cap + *cap / 2;
+
+    if (*cap != 0 && slabClass(*cap) == ZILO_SLAB_CLASSES)
+    {
+        char *np = realloc(p, want);
+        if (np)
+        {
+            memTrack(kind, want - *cap, 0);
+            *cap = want;
+        }
+        return np;
+    }
+
+    int newcap;
+    char *np = slabAlloc(kind, want, &newcap);
+    if (np == NULL)
+        return NULL;
+    memcpy(np, p, len);
+    slabFree(kind, p, *cap);
+    *cap = newcap;
+    return np;
+}
+
+char *arenaAlloc(size_t n)
+{
+    n = (n + sizeof(char *) - 1) & ~(sizeof(char *) - 1);
+    if (arena == NULL || arena_size < arena_used + n)
+    {
+        size_t size = sizeof(char *) + n;
+        if (size < ZILO_ARENA_CHUNK)
+            size = ZILO_ARENA_CHUNK;
+        char *chunk = malloc(size);
+        if (chunk == NULL)
+            return NULL;
+        memcpy(chunk, &arena, sizeof(char *));
+        mem.arena += size;
+        mem.arena_used += sizeof(char *);
+        arena = chunk;
+        arena_size = size;
+        arena_used = sizeof(char *);
+    }
+    char *p = &arena[arena_used];
+    arena_used += n;
+    mem.arena_used += n;
+    return p;
+}
+
+// take a malloc'd chunk of size bytes, already full, into the arena; its
+// first bytes become the link, and it goes below the chunk being filled
+void arenaAdopt(char *chunk, size_t size)
+{
+    if (arena == NULL)
+    {
+        memcpy(chunk, &arena, sizeof(char *));
+        arena = chunk;
+        arena_size = size;
+        arena_used = size;
+    }
+    else
+    {
+        char *below;
+        memcpy(&below, arena, sizeof(char *));
+        memcpy(chunk, &below, sizeof(char *));
+        memcpy(arena, &chunk, sizeof(char *));
+    }
+    mem.arena += size;
+    mem.arena_used += size;
+}
+
+void arenaFree()
+{
+    while (arena)
+    {
+        char *prev;
+        memcpy(&prev, arena, sizeof(char *));
+        free(arena);
+        arena = prev;
+    }
+    arena_used = 0;
+    arena_size = 0;
+    mem.arena = 0;
+    mem.arena_used = 0;
+}
+
+/*** syntax highlighting ***/
+
+int is_separator(int c)
+{
+    return isspace(c) || c == '\0' || strchr(",.()+-/*=~%<>[];", c) != NULL;
+}
+
+// scratch buffer holding one highlight byte per render char while a row is
+// being highlighted; rows themselves only keep the run-length encoded form
+unsigned char *hlbuf = NULL;
+int hlbufsize = 0;
+
+unsigned char *editorHlBuffer(int len)
+{
+    if (hlbufsize < len + 1)
+    {
+        hlbufsize = len + 1;
+        hlbuf = memRealloc(MEM_HL, hlbuf, hlbufsize);
+    }
+    return hlbuf;
+}
+
+int editorHlRuns(const unsigned char *hl, int len, hlspan *spans)
+{
+    int nhl = 0;
+    int i = 0;
+    while (i < len)
+    {
+        int j = i;
+        while (j < len && hl[j] == hl[i] && j - i < HLSPAN_MAX)
+            j++;
+        if (spans)
+        {
+            spans[nhl].len = j - i;
+            spans[nhl].hl = hl[i];
+        }
+        nhl++;
+        i = j;
+    }
+    return nhl;
+}
+
+void editorRowSetHl(erow *row, const unsigned char *hl, int len)
+{
+    int nhl = editorHlRuns(hl, len, NULL);
+
+    // a row that is entirely HL_NORMAL needs no spans at all
+    if (nhl == 0 || (nhl == 1 && hl[0] == HL_NORMAL))
+    {
+        memFree(MEM_HL, row->hl);
+        row->hl = NULL;
+        row->nhl = 0;
+        return;
+    }
+
+    if (nhl != row->nhl)
+        row->hl = memRealloc(MEM_HL, row->hl, sizeof(hlspan) * nhl);
+    row->nhl = editorHlRuns(hl, len, row->hl);
+}
+
+void editorLexMark(unsigned char *hl, int base, int to, int at, int n, int v)
+{
+    if (hl == NULL)
+        return;
+    if (to - at < n)
+        n = to - at;
+    if (0 < n)
+        memset(&hl[at - base], v, n);
+}
+
+// Highlight s[i..to) of a line of length len, continuing from state *st.
+// hl[0] corresponds to s[base] and may be NULL to only advance the state.
+// Returns where the lexer stopped, which is past `to` when a token
+// straddles it.
+int editorLex(struct lexState *st, const char *s, int len, int i, int to, unsigned char *hl, int base)
+{
+    char **keywords = E.syntax->keywords;
+
+    char *scs = E.syntax->singleline_comment_start;
+    char *mcs = E.syntax->multiline_comment_start;
+    char *mce = E.syntax->multiline_comment_end;
+
+    int scs_len = scs ? strlen(scs) : 0;
+    int mcs_len = mcs ? strlen(mcs) : 0;
+    int mce_len = mce ? strlen(mce) : 0;
+
+    if (st->line_comment)
+    {
+        editorLexMark(hl, base, to, i, to - i, HL_COMMENT);
+        return i < to ? to : i;
+    }
+
+    while (i < to)
+    {
+        char c = s[i];
+
+        if (scs_len && !st->in_string && !st->in_comment)
+        {
+            if (!strncmp(&s[i], scs, scs_len))
+            {
+                editorLexMark(hl, base, to, i, to - i, HL_COMMENT);
+                st->line_comment = 1;
+                st->prev_hl = HL_COMMENT;
+                return to;
+            }
+        }
+
+        if (mcs_len && mce_len && !st->in_string)
+        {
+            if (st->in_comment)
+            {
+                st->prev_hl = HL_MLCOMMENT;
+                if (!strncmp(&s[i], mce, mce_len))
+                {
+                    editorLexMark(hl, base, to, i, mce_len, HL_MLCOMMENT);
+                    i += mce_len;
+                    st->in_comment = 0;
+                    st->prev_sep = 1;
+                    continue;
+                }
+                else
+                {
+                    editorLexMark(hl, base, to, i, 1, HL_MLCOMMENT);
+                    i++;
+                    continue;
+                }
+            }
+            else if (!strncmp(&s[i], mcs, mcs_len))
+            {
+                editorLexMark(hl, base, to, i, mcs_len, HL_MLCOMMENT);
+                i += mcs_len;
+                st->in_comment = 1;
+                st->prev_hl = HL_MLCOMMENT;
+                continue;
+            }
+        }
+
+        if (E.syntax->flags & HL_HIGHLIGHT_STRINGS)
+        {
+            if (st->in_string)
+            {
+                editorLexMark(hl, base, to, i, 1, HL_STRING);
+                st->prev_hl = HL_STRING;
+                if (c == '\\' && i + 1 < len)
+                {
+                    editorLexMark(hl, base, to, i + 1, 1, HL_STRING);
+                    i += 2;
+                    continue;
+                }
+
+                if (c == st->in_string)
+                    st->in_string = 0;
+                i++;
+                st->prev_sep = 1;
+                continue;
+            }
+            else
+            {
+                if (c == '"' || c == '\'')
+                {
+                    st->in_string = c;
+                    editorLexMark(hl, base, to, i, 1, HL_STRING);
+                    st->prev_hl = HL_STRING;
+                    i++;
+                    continue;
+                }
+            }
+        }
+
+        if (E.syntax->flags & HL_HIGHLIGHT_NUMBERS)
+        {
+            if ((isdigit(c) && (st->prev_sep || st->prev_hl == HL_NUMBER)) ||
+                (c == '.' && st->prev_hl == HL_NUMBER))
+            {
+                editorLexMark(hl, base, to, i, 1, HL_NUMBER);
+                st->prev_hl = HL_NUMBER;
+                i++;
+                st->prev_sep = 0;
+                continue;
+            }
+        }
+
+        if (st->prev_sep)
+        {
+            int j;
+            for (j = 0; keywords[j]; j++)
+            {
+                int klen = strlen(keywords[j]);
+                int kw2 = keywords[j][klen - 1] == '|';
+                if (kw2)
+                    klen--;
+                if (!strncmp(&s[i], keywords[j], klen) &&
+                    is_separator(s[i + klen]))
+                {
+                    editorLexMark(hl, base, to, i, klen, kw2 ? HL_KEYWORD2 : HL_KEYWORD1);
+                    st->prev_hl = kw2 ? HL_KEYWORD2 : HL_KEYWORD1;
+                    i += klen;
+                    break;
+                }
+            }
+            if (keywords[j] != NULL)
+            {
+                st->prev_sep = 0;
+                continue;
+            }
+        }
+
+        st->prev_sep = is_separator(c);
+        st->prev_hl = HL_NORMAL;
+        i++;
+    }
+    return i;
+}
+
+// whether the row above ends inside a multi-line comment
+int editorRowCommentBefore(erow *row)
+{
+    if (view.fd != -1)
+    {
+        // viewer blocks are erow arrays highlighted top to bottom
+        if (row->idx % ZILO_VIEW_BLOCK)
+            return row[-1].hl_open_comment;
+        return view.comment[row->idx / ZILO_VIEW_BLOCK];
+    }
+    return row->idx > 0 && E.row[row->idx - 1].hl_open_comment;
+}
+
+void editorUpdateSyntax(erow *row)
+{
+    if (view.fd == -1)
+    {
+        editorBracketTouch(row->idx);
+        editorOutlineTouch(row->idx);
+    }
+    double t = perfStart();
+    if (E.syntax == NULL)
+    {
+        if (row->lr)
+            editorLongHighlight(row);
+        else
+            editorRowSetHl(row, NULL, 0);
+        perfStop(PERF_SYNTAX, t);
+        return;
+    }
+
+    struct lexState st = {0, 0, 0, 1, HL_NORMAL};
+    st.in_comment = editorRowCommentBefore(row);
+
+    int in_comment;
+    if (row->lr)
+    {
+        in_comment = editorLongRelex(row, st);
+        editorLongHighlight(row);
+    }
+    else
+    {
+        unsigned char *hl = editorHlBuffer(row->rsize);
+        memset(hl, HL_NORMAL, row->rsize);
+        editorLex(&st, row->render, row->rsize, 0, row->rsize, hl, 0);
+        editorRowSetHl(row, hl, row->rsize);
+        in_comment = st.in_comment;
+    }
+
+    int changed = (row->hl_open_comment != in_comment);
+    row->hl_open_comment = in_comment;
+    perfStop(PERF_SYNTAX, t); // the next row times itself
+    if (changed && row->idx + 1 < E.numrows && view.fd == -1)
+        editorUpdateSyntax(&E.row[row->idx + 1]);
+}
+
+int editorSyntaxToColor(int hl)
+{
+    switch (hl)
+    {
+    case HL_COMMENT:
+    case HL_MLCOMMENT:
+        return 36; // cyan
+    case HL_KEYWORD1:
+        return 33; // yellow
+    case HL_KEYWORD2:
+        return 32; // green
+    case HL_STRING:
+        return 35; // magenta
+    case HL_NUMBER:
+        return 31; // red
+    case HL_MATCH:
+        return 34; // blue
+    default:
+        return 37;
+    }
+}
+
+void editorSelectSyntaxHighlight()
+{
+    E.syntax = NULL;
+    if (E.filename == NULL)
+        return;
+
+    char *ext = strrchr(E.filename, '.');
+
+    for (unsigned int j = 0; j < HLDB_ENTRIES; j++)
+    {
+        struct editorSyntax *s = &HLDB[j];
+        unsigned int i = 0;
+        while (s->filematch[i])
+        {
+            int is_ext = (s->filematch[i][0] == '.');
+            if ((is_ext && ext && !strcmp(ext, s->filematch[i])) ||
+                (!is_ext && strstr(E.filename, s->filematch[i])))
+            {
+                E.syntax = s;
+
+                int filerow;
+                for (filerow = 0; filerow < E.numrows && view.fd == -1; filerow++)
+                {
+                    if (E.row[filerow].lr)
+                        E.row[filerow].lr->dirty = 0; // checkpoints came from another syntax
+                    editorUpdateSyntax(&E.row[filerow]);
+                }
+
+                return;
+            }
+            i++;
+        }
+    }
+}
+
+/*** long rows ***/
+
+// Rows of ZILO_LONG_LINE chars or more never get a full render or a full
+// highlight. render holds only the columns around the view and the lexer
+// keeps checkpoints of its state along chars, so a window can be
+// highlighted by lexing from the nearest checkpoint and an edit only
+// relexes until the state matches an old checkpoint again.
+
+int editorLongCheckpoint(struct longRow *lr, int pos)
+{
+    int lo = 0;
+    int hi = lr->nlx;
+    while (1 < hi - lo)
+    {
+        int mid = (lo + hi) / 2;
+        if (lr->lx[mid].pos <= pos)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+// shift checkpoints for `delta` chars inserted (or removed) at `at`
+void editorLongEdit(erow *row, int at, int delta)
+{
+    struct longRow *lr = row->lr;
+    if (lr == NULL)
+        return;
+
+    int n = 0;
+    for (int j = 0; j < lr->nlx; j++)
+    {
+        int pos = lr->lx[j].pos;
+        if (at < pos)
+        {
+            if (delta < 0 && pos <= at - delta)
+                continue;
+            pos += delta;
+        }
+        lr->lx[n] = lr->lx[j];
+        lr->lx[n++].pos = pos;
+    }
+    lr->nlx = n;
+    if (at < lr->dirty)
+        lr->dirty = at;
+}
+
+void editorLongAddCheckpoint(struct lexCheckpoint **lx, int *n, int *cap, int pos, struct lexState st)
+{
+    if (*cap <= *n)
+    {
+        *cap = *cap ? *cap * 2 : 16;
+        *lx = memRealloc(MEM_LONG, *lx, sizeof(struct lexCheckpoint) * *cap);
+    }
+    (*lx)[*n].pos = pos;
+    (*lx)[*n].st = st;
+    (*n)++;
+}
+
+// how far past a char the lexer may look before it decides how to highlight it
+int editorLexReach()
+{
+    int reach = 2; // an escape inside a string
+    char *delims[] = {E.syntax->singleline_comment_start,
+                      E.syntax->multiline_comment_start,
+                      E.syntax->multiline_comment_end};
+    for (unsigned int j = 0; j < sizeof(delims) / sizeof(delims[0]); j++)
+    {
+        if (delims[j] && reach < (int)strlen(delims[j]))
+            reach = strlen(delims[j]);
+    }
+    for (int j = 0; E.syntax->keywords[j]; j++)
+    {
+        int klen = strlen(E.syntax->keywords[j]) + 1; // and the separator after it
+        if (reach < klen)
+            reach = klen;
+    }
+    return reach;
+}
+
+// bring the checkpoints up to date, returning the lexer's in_comment at the end of the row
+int editorLongRelex(erow *row, struct lexState start)
+{
+    struct longRow *lr = row->lr;
+    if (lr->nlx == 0 || memcmp(&lr->lx[0].st, &start, sizeof(start)))
+        lr->dirty = 0;
+    if (lr->dirty == INT_MAX)
+        return row->hl_open_comment;
+
+    struct lexCheckpoint *old = lr->lx;
+    int nold = lr->nlx;
+    // lookahead from before the edit may have read the changed chars
+    int k = nold ? editorLongCheckpoint(lr, lr->dirty - editorLexReach()) : 0;
+
+    struct lexCheckpoint *lx = NULL;
+    int n = 0;
+    int cap = 0;
+    if (k == 0)
+        editorLongAddCheckpoint(&lx, &n, &cap, 0, start);
+    else
+        for (int j = 0; j <= k; j++)
+            editorLongAddCheckpoint(&lx, &n, &cap, old[j].pos, old[j].st);
+
+    // old checkpoints past the edit only depend on the chars after them, so
+    // meeting one of them in the same state means the rest is unchanged
+    struct lexState st = lx[n - 1].st;
+    int p = lx[n - 1].pos;
+    int m = k + 1;
+    while (m < nold && old[m].pos <= lr->dirty)
+        m++;
+    int converged = 0;
+    while (p < row->size)
+    {
+        int target = (m < nold) ? old[m].pos : p + ZILO_LEX_STEP;
+        if (p + 2 * ZILO_LEX_STEP < target)
+            target = p + ZILO_LEX_STEP;
+        if (row->size < target)
+            target = row->size;
+
+        p = editorLex(&st, row->chars, row->size, p, target, NULL, 0);
+
+        while (m < nold && old[m].pos < p)
+            m++;
+        if (m < nold && old[m].pos == p && !memcmp(&old[m].st, &st, sizeof(st)))
+        {
+            for (; m < nold; m++)
+                editorLongAddCheckpoint(&lx, &n, &cap, old[m].pos, old[m].st);
+            converged = 1;
+            break;
+        }
+        if (p < row->size)
+            editorLongAddCheckpoint(&lx, &n, &cap, p, st);
+        if (m < nold && old[m].pos == p)
+            m++;
+    }
+
+    memFree(MEM_LONG, old);
+    lr->lx = lx;
+    lr->nlx = n;
+    lr->dirty = INT_MAX;
+    return converged ? row->hl_open_comment : st.in_comment;
+}
+
+// highlight the chars expanded into render, lexing from the nearest checkpoint
+void editorLongHighlight(erow *row)
+{
+    struct longRow *lr = row->lr;
+    if (E.syntax == NULL || lr->nlx == 0)
+    {
+        editorRowSetHl(row, NULL, 0);
+        return;
+    }
+
+    struct lexCheckpoint *ck = &lr->lx[editorLongCheckpoint(lr, lr->cx0)];
+    struct lexState st = ck->st;
+    int from = ck->pos;
+
+    // char highlights go behind the render highlights, which never outrun them
+    unsigned char *hl = editorHlBuffer(row->rsize + lr->cx1 - from);
+    unsigned char *chl = &hl[row->rsize];
+    memset(chl, HL_NORMAL, lr->cx1 - from);
+    editorLex(&st, row->chars, row->size, from, lr->cx1, chl, from);
+
+    // a tab spreads over its render columns, other chars keep one per byte
+    int r = 0;
+    int col = lr->roff;
+    int cx = lr->cx0;
+    while (cx < lr->cx1)
+    {
+        unsigned char c = row->chars[cx];
+        if (c == '\t')
+        {
+            int w = ZILO_TAB_STOP - col % ZILO_TAB_STOP;
+            memset(&hl[r], chl[cx - from], w);
+            r += w;
+            col += w;
+            cx++;
+            continue;
+        }
+
+        int n = 1;
+        int w = 1;
+        if (0x80 <= c)
+        {
+            unsigned int cp;
+            n = utf8Decode(&row->chars[cx], row->size - cx, &cp);
+            w = unicodeWidth(cp);
+        }
+        memcpy(&hl[r], &chl[cx - from], n);
+        r += n;
+        col += w;
+        cx += n;
+    }
+    editorRowSetHl(row, hl, row->rsize);
+}
+
+// expand the chars around render column rx0 into render
+void editorLongExpand(erow *row, int rx0)
+{
+    struct longRow *lr = row->lr;
+    if (row->render == row->chars)
+        row->render = NULL;
+
+    int cx0 = editorRowRxToCx(row, rx0);
+    int roff = editorRowCxToRx(row, cx0);
+    int cx1 = editorRowNextChar(row, editorRowRxToCx(row, roff + E.screencols + 2 * ZILO_LONG_MARGIN));
+
+    int tabs = 0;
+    for (int j = cx0; j < cx1; j++)
+    {
+        if (row->chars[j] == '\t')
+            tabs++;
+    }
+
+    int need = (cx1 - cx0) + tabs * (ZILO_TAB_STOP - 1) + 1;
+    if (row->render == NULL || row->rcap < need)
+    {
+        slabFree(MEM_RENDER, row->render, row->rcap);
+        row->render = slabAlloc(MEM_RENDER, need, &row->rcap);
+    }
+
+    row->rsize = editorRowExpand(row, cx0, cx1, roff, row->render);
+
+    lr->roff = roff;
+    lr->cx0 = cx0;
+    lr->cx1 = cx1;
+}
+
+// make sure render covers the view starting at column coloff
+void editorLongFocus(erow *row, int coloff)
+{
+    struct longRow *lr = row->lr;
+    if (lr == NULL)
+        return;
+    if (lr->roff <= coloff &&
+        (coloff + E.screencols <= lr->roff + row->rsize || lr->cx1 == row->size))
+        return;
+
+    int rx0 = coloff - ZILO_LONG_MARGIN;
+    editorLongExpand(row, rx0 < 0 ? 0 : rx0);
+    editorLongHighlight(row);
+}
+
+void editorLongFree(erow *row)
+{
+    if (row->lr == NULL)
+        return;
+    memFree(MEM_LONG, row->lr->lx);
+    memFree(MEM_LONG, row->lr);
+    row->lr = NULL;
+}
+
+/*** soft wrap ***/
+
+// A row takes one screen line per screencols columns of its render, plus
+// the one its end lands on so the cursor always has a place after the last
+// char. A wide char that would straddle the right edge starts the next line
+// instead, and every line after it starts a column earlier than the grid;
+// only rows where that happens keep their line starts, found from the
+// stops of their wide chars. Edits within a row adjust the tree in
+// O(log n) from editorUpdateRow and rows appended at the end extend it in
+// O(log n); inserting or deleting a row mid-buffer already costs a memmove
+// of E.row, so the tree is rebuilt in linear time the next time it is asked.
+
+// line starts of row, NULL when they all fall on multiples of the width
+struct wrapBreaks *editorWrapBreaks(erow *row)
+{
+    int w = wrap.width;
+    int end = editorRowCxToRx(row, row->size);
+    struct wrapBreaks *b = NULL;
+    int start = 0; // of the line the last pushed down char began
+    int n = 1;
+    for (int j = 0; j < row->nts && 2 <= w; j++)
+    {
+        tabstop *t = &row->ts[j];
+        int rx = editorRowStopRx(row, j);
+        if (!t->mb || t->rx - rx < 2)
+            continue;
+        int k = (rx - start) / w; // whole lines between start and rx
+        if ((int)t->rx <= start + (k + 1) * w)
+            continue;
+        if (b == NULL)
+        {
+            // every line holds at least w - 1 columns
+            b = memRealloc(MEM_WRAP, NULL, sizeof(*b) + sizeof(int) * (end / (w - 1) + 2));
+            for (int i = 0; i < n; i++)
+                b->rx[i] = i * w;
+        }
+        for (int i = 1; i <= k; i++)
+            b->rx[n++] = start + i * w;
+        start = rx;
+        b->rx[n++] = start;
+    }
+    if (b == NULL)
+        return NULL;
+    for (int i = 1; i <= (end - start) / w; i++)
+        b->rx[n++] = start + i * w;
+    b = memRealloc(MEM_WRAP, b, sizeof(*b) + sizeof(int) * n);
+    b->n = n;
+    return b;
+}
+
+// screen lines of row, refreshing its line starts on the way
+int editorWrapHeight(erow *row)
+{
+    memFree(MEM_WRAP, wrap.breaks[row->idx]);
+    wrap.breaks[row->idx] = editorWrapBreaks(row);
+    if (editorFoldHidden(row->idx))
+        return 0; // folded away, editorWrapFind steps over it
+    if (wrap.breaks[row->idx])
+        return wrap.breaks[row->idx]->n;
+    return editorRowCxToRx(row, row->size) / wrap.width + 1;
+}
+
+// line starts of rows [from, to) are gone
+void editorWrapDrop(int from, int to)
+{
+    for (int j = from; j < to; j++)
+    {
+        memFree(MEM_WRAP, wrap.breaks[j]);
+        wrap.breaks[j] = NULL;
+    }
+}
+
+void editorWrapReserve(int n)
+{
+    if (n <= wrap.cap)
+        return;
+    int old = wrap.cap;
+    while (wrap.cap < n)
+        wrap.cap = wrap.cap ? wrap.cap * 2 : 16;
+    wrap.height = memRealloc(MEM_WRAP, wrap.height, sizeof(int) * wrap.cap);
+    wrap.tree = memRealloc(MEM_WRAP, wrap.tree, sizeof(int) * (wrap.cap + 1));
+    wrap.breaks = memRealloc(MEM_WRAP, wrap.breaks, sizeof(struct wrapBreaks *) * wrap.cap);
+    memset(&wrap.breaks[old], 0, sizeof(struct wrapBreaks *) * (wrap.cap - old));
+}
+
+// screen lines of the rows before i, the tree must be current
+int editorWrapSum(int i)
+{
+    int sum = 0;
+    for (; 0 < i; i -= i & -i)
+        sum += wrap.tree[i];
+    return sum;
+}
+
+void editorWrapAdd(int i, int delta)
+{
+    for (i++; i <= wrap.n; i += i & -i)
+        wrap.tree[i] += delta;
+}
+
+// bring the counts and the tree up to date with the rows and screen width
+void editorWrapSync()
+{
+    if (wrap.width != E.screencols)
+    {
+        wrap.width = E.screencols; // the line starts move too
+        for (int j = 0; j < wrap.n; j++)
+            wrap.height[j] = editorWrapHeight(&E.row[j]);
+        wrap.stale = 1;
+    }
+    if (!wrap.stale)
+        return;
+    for (int i = 1; i <= wrap.n; i++)
+        wrap.tree[i] = wrap.height[i - 1];
+    for (int i = 1; i <= wrap.n; i++)
+    {
+        int up = i + (i & -i);
+        if (up <= wrap.n)
+            wrap.tree[up] += wrap.tree[i];
+    }
+    wrap.stale = 0;
+}
+
+// called from editorUpdateRow with the row's stops already current
+void editorWrapRow(erow *row)
+{
+    if (!wrap.enabled || wrap.n <= row->idx)
+        return;
+    int h = editorWrapHeight(row);
+    int delta = h - wrap.height[row->idx];
+    if (delta == 0)
+        return;
+    wrap.height[row->idx] = h;
+    if (!wrap.stale)
+        editorWrapAdd(row->idx, delta);
+}
+
+// ins rows are about to be inserted at at, or -ins rows were deleted from it;
+// a new row counts 0 until editorWrapRow sees it
+void editorWrapSplice(int at, int ins)
+{
+    if (!wrap.enabled)
+        return;
+    if (0 < ins)
+    {
+        editorWrapReserve(wrap.n + ins);
+        memmove(&wrap.height[at + ins], &wrap.height[at], sizeof(int) * (wrap.n - at));
+        memset(&wrap.height[at], 0, sizeof(int) * ins);
+        memmove(&wrap.breaks[at + ins], &wrap.breaks[at], sizeof(struct wrapBreaks *) * (wrap.n - at));
+        memset(&wrap.breaks[at], 0, sizeof(struct wrapBreaks *) * ins);
+        wrap.n += ins;
+        if (ins == 1 && at == wrap.n - 1 && !wrap.stale)
+        {
+            // the new node covers rows the tree already sums
+            int i = wrap.n;
+            wrap.tree[i] = editorWrapSum(i - 1) - editorWrapSum(i - (i & -i));
+            return;
+        }
+    }
+    else
+    {
+        memmove(&wrap.height[at], &wrap.height[at - ins], sizeof(int) * (wrap.n - at + ins));
+        editorWrapDrop(at, at - ins);
+        memmove(&wrap.breaks[at], &wrap.breaks[at - ins], sizeof(struct wrapBreaks *) * (wrap.n - at + ins));
+        memset(&wrap.breaks[wrap.n + ins], 0, sizeof(struct wrapBreaks *) * -ins);
+        wrap.n += ins;
+        if (at == wrap.n)
+            return; // no node below the last covers them
+    }
+    wrap.stale = 1;
+}
+
+// screen lines before row at, which may be E.numrows
+int editorWrapPrefix(int at)
+{
+    editorWrapSync();
+    return editorWrapSum(at);
+}
+
+// render column that screen line seg of row i starts at
+int editorWrapStart(int i, int seg)
+{
+    editorWrapSync();
+    if (i < wrap.n && wrap.breaks[i])
+        return wrap.breaks[i]->rx[seg];
+    return seg * wrap.width;
+}
+
+// screen line of row i that render column rx is on
+int editorWrapLine(int i, int rx)
+{
+    editorWrapSync();
+    if (wrap.n <= i || wrap.breaks[i] == NULL)
+        return rx / wrap.width;
+    struct wrapBreaks *b = wrap.breaks[i];
+    int lo = 0;
+    int hi = b->n - 1;
+    while (lo < hi)
+    {
+        int mid = (lo + hi + 1) / 2;
+        if (b->rx[mid] <= rx)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+    return lo;
+}
+
+// the row holding screen line v, with seg set to the line within it; past
+// the last row it returns E.numrows
+int editorWrapFind(int v, int *seg)
+{
+    editorWrapSync();
+    int pos = 0;
+    int step = 1;
+    while (step * 2 <= wrap.n)
+        step *= 2;
+    for (; step; step /= 2)
+    {
+        if (pos + step <= wrap.n && wrap.tree[pos + step] <= v)
+        {
+            pos += step;
+            v -= wrap.tree[pos];
+        }
+    }
+    *seg = v;
+    return pos;
+}
+
+// screen line of the cursor counted from the top of the buffer
+int editorWrapCursor()
+{
+    int rx = E.cy < E.numrows ? editorRowCxToRx(&E.row[E.cy], E.cx) : 0;
+    return editorWrapPrefix(E.cy) + editorWrapLine(E.cy, rx);
+}
+
+// put the cursor on screen line v, keeping its column within the line
+void editorWrapGoto(int v)
+{
+    int total = editorWrapPrefix(E.numrows);
+    int rx = E.cy < E.numrows ? editorRowCxToRx(&E.row[E.cy], E.cx) : 0;
+    rx -= editorWrapStart(E.cy, editorWrapLine(E.cy, rx));
+    if (v < 0)
+        v = 0;
+    if (total < v)
+        v = total;
+
+    int seg;
+    E.cy = editorWrapFind(v, &seg);
+    E.cx = 0;
+    if (E.cy < E.numrows)
+    {
+        erow *row = &E.row[E.cy];
+        E.cx = editorRowRxToCx(row, editorWrapStart(E.cy, seg) + rx);
+        if (row->size < E.cx)
+            E.cx = row->size;
+        // a tab or wide char starting on the line above isn't on this one,
+        // nor is a wide char pushed down to the line below
+        int line = editorWrapLine(E.cy, editorRowCxToRx(row, E.cx));
+        if (line < seg)
+            E.cx = editorRowNextChar(row, E.cx);
+        else if (seg < line)
+            E.cx = editorRowPrevChar(row, E.cx);
+    }
+}
+
+// keep the cursor's screen line in view, E.rx must be current
+void editorWrapScroll()
+{
+    editorWrapSync();
+    E.coloff = 0;
+    if (E.numrows <= E.rowoff)
+        E.segoff = 0;
+    else if (wrap.height[E.rowoff] <= E.segoff)
+        E.segoff = wrap.height[E.rowoff] ? wrap.height[E.rowoff] - 1 : 0;
+
+    int cursor = editorWrapPrefix(E.cy) + editorWrapLine(E.cy, E.rx);
+    int top = editorWrapPrefix(E.rowoff) + E.segoff;
+    if (cursor < top)
+        top = cursor;
+    if (top + E.screenrows <= cursor)
+        top = cursor - E.screenrows + 1;
+    E.rowoff = editorWrapFind(top, &E.segoff);
+}
+
+void editorWrapToggle()
+{
+    if (view.fd != -1)
+    {
+        editorSetStatusMessage("Soft wrap isn't available in the viewer");
+        return;
+    }
+    wrap.enabled = !wrap.enabled;
+    E.coloff = 0;
+    E.segoff = 0;
+    if (wrap.enabled)
+    {
+        editorWrapReserve(E.numrows);
+        wrap.n = E.numrows;
+        wrap.width = E.screencols;
+        for (int j = 0; j < wrap.n; j++)
+            wrap.height[j] = editorWrapHeight(&E.row[j]);
+        wrap.stale = 1;
+    }
+    else
+    {
+        editorWrapDrop(0, wrap.n);
+        memFree(MEM_WRAP, wrap.height);
+        memFree(MEM_WRAP, wrap.tree);
+        memFree(MEM_WRAP, wrap.breaks);
+        wrap.height = NULL;
+        wrap.tree = NULL;
+        wrap.breaks = NULL;
+        wrap.n = 0;
+        wrap.cap = 0;
+    }
+    editorSetStatusMessage("Soft wrap %s", wrap.enabled ? "on" : "off");
+}
+
+/*** brackets ***/
+
+// Every row has a bracketNode summarizing the (), [] and {} outside its
+// strings and comments, and a segment tree combines them over runs of
+// rows. A search for the bracket matching one with d brackets still open
+// skips any run that can't bring d to zero, so it only descends into the
+// one row holding the match: O(log n) whatever the distance. Rows are
+// classified by the same lexer as editorUpdateSyntax, run over chars.
+//
+// The tree is built on first use. After that an edit only marks its leaf
+// and the path above it dirty, and a search recomputes dirty subtrees
+// before descending, so typing costs nothing until the next search.
+
+int editorBracketOpens(char c)
+{
+    return c == '(' || c == '[' || c == '{';
+}
+
+int editorBracketCloses(char c)
+{
+    return c == ')' || c == ']' || c == '}';
+}
+
+void editorBracketPush(int *n, int cx)
+{
+    if (bracket.listcap <= *n)
+    {
+        bracket.listcap = bracket.listcap ? bracket.listcap * 2 : 64;
+        bracket.list = memRealloc(MEM_BRACKET, bracket.list, sizeof(int) * bracket.listcap);
+    }
+    bracket.list[(*n)++] = cx;
+}
+
+int editorBracketLive(unsigned char hl)
+{
+    return hl != HL_STRING && hl != HL_COMMENT && hl != HL_MLCOMMENT;
+}
+
+// collect the cx of each bracket of row outside strings and comments into
+// bracket.list, returns how many
+int editorRowBrackets(erow *row)
+{
+    int n = 0;
+    if (row->lr == NULL)
+    {
+        // read the row's own highlight, rendering tabs only shifts it
+        int extra = 0; // render bytes past cx from the tabs before it
+        int stop = 0;
+        int span = 0;
+        int pos = 0; // render offset where span starts
+        for (int j = 0; j < row->size; j++)
+        {
+            char c = row->chars[j];
+            if (!editorBracketOpens(c) && !editorBracketCloses(c))
+                continue;
+            for (; stop < row->nts && (int)row->ts[stop].cx < j; stop++)
+                if (!row->ts[stop].mb)
+                    extra += row->ts[stop].rx - editorRowStopRx(row, stop) - 1;
+            while (span < row->nhl && pos + (int)row->hl[span].len <= j + extra)
+                pos += row->hl[span++].len;
+            if (span == row->nhl || editorBracketLive(row->hl[span].hl))
+                editorBracketPush(&n, j);
+        }
+        return n;
+    }
+
+    // long rows only keep the highlight of a window, lex all of chars in steps
+    struct lexState st = {0, 0, 0, 1, HL_NORMAL};
+    st.in_comment = editorRowCommentBefore(row);
+    for (int i = 0; i < row->size;)
+    {
+        int to = row->size - i < ZILO_LEX_STEP ? row->size : i + ZILO_LEX_STEP;
+        int next = to;
+        unsigned char *hl = NULL;
+        if (E.syntax)
+        {
+            hl = editorHlBuffer(to - i);
+            memset(hl, HL_NORMAL, to - i);
+            next = editorLex(&st, row->chars, row->size, i, to, hl, i);
+        }
+        for (int j = i; j < to; j++)
+        {
+            char c = row->chars[j];
+            if ((editorBracketOpens(c) || editorBracketCloses(c)) && (hl == NULL || editorBracketLive(hl[j - i])))
+                editorBracketPush(&n, j);
+        }
+        i = next < to ? to : next; // a token straddling to was lexed whole
+    }
+    return n;
+}
+
+struct bracketNode editorBracketCombine(struct bracketNode a, struct bracketNode b)
+{
+    struct bracketNode c;
+    c.net = a.net + b.net;
+    c.minpre = a.net + b.minpre < a.minpre ? a.net + b.minpre : a.minpre;
+    c.maxsuf = b.net + a.maxsuf > b.maxsuf ? b.net + a.maxsuf : b.maxsuf;
+    return c;
+}
+
+struct bracketNode editorBracketRow(erow *row)
+{
+    struct bracketNode t = {0, 0, 0};
+    int n = editorRowBrackets(row);
+    for (int k = 0; k < n; k++)
+    {
+        t.net += editorBracketOpens(row->chars[bracket.list[k]]) ? 1 : -1;
+        if (t.net < t.minpre)
+            t.minpre = t.net;
+    }
+    // the best tail is found walking back from the end
+    int suf = 0;
+    for (int k = n - 1; 0 <= k; k--)
+    {
+        suf += editorBracketOpens(row->chars[bracket.list[k]]) ? 1 : -1;
+        if (t.maxsuf < suf)
+            t.maxsuf = suf;
+    }
+    return t;
+}
+
+void editorBracketDirty(int node)
+{
+    for (; 1 <= node && bracket.t[node].minpre != BRACKET_DIRTY; node /= 2)
+        bracket.t[node].minpre = BRACKET_DIRTY;
+}
+
+// room for n leaves, all unknown when the tree is new
+void editorBracketReserve(int n)
+{
+    if (bracket.t && n <= bracket.size)
+        return;
+    int size = bracket.size ? bracket.size : 16;
+    while (size < n)
+        size *= 2;
+    struct bracketNode *t = memRealloc(MEM_BRACKET, NULL, sizeof(struct bracketNode) * 2 * size);
+    for (int i = 0; i < 2 * size; i++)
+        t[i].minpre = BRACKET_DIRTY;
+    if (bracket.t)
+        memcpy(&t[size], &bracket.t[bracket.size], sizeof(struct bracketNode) * bracket.n);
+    memFree(MEM_BRACKET, bracket.t);
+    bracket.t = t;
+    bracket.size = size;
+}
+
+void editorBracketMark(int leaf)
+{
+    bracket.t[bracket.size + leaf].minpre = BRACKET_DIRTY;
+    editorBracketDirty((bracket.size + leaf) / 2);
+}
+
+// the edit hook: row at needs summarizing again
+void editorBracketTouch(int at)
+{
+    if (bracket.t && at < bracket.n)
+        editorBracketMark(at);
+}
+
+// ins rows are about to be inserted at at, or -ins rows were deleted from it;
+// at the end that only moves the end, mid-buffer the leaves shift and every
+// inner node is recombined on the next search
+void editorBracketSplice(int at, int ins)
+{
+    if (bracket.t == NULL)
+        return;
+    if (0 < ins)
+    {
+        editorBracketReserve(bracket.n + ins);
+        struct bracketNode *leaf = &bracket.t[bracket.size];
+        memmove(&leaf[at + ins], &leaf[at], sizeof(struct bracketNode) * (bracket.n - at));
+        bracket.n += ins;
+        for (int j = at; j < at + ins; j++)
+            editorBracketMark(j);
+        if (at < bracket.n - ins)
+            bracket.stale = 1;
+    }
+    else
+    {
+        struct bracketNode *leaf = &bracket.t[bracket.size];
+        memmove(&leaf[at], &leaf[at - ins], sizeof(struct bracketNode) * (bracket.n - at + ins));
+        bracket.n += ins;
+        for (int j = bracket.n; j < bracket.n - ins; j++)
+            editorBracketMark(j); // back to empty
+        if (at < bracket.n)
+            bracket.stale = 1;
+    }
+}
+
+void editorBracketClean(int node)
+{
+    struct bracketNode *t = &bracket.t[node];
+    if (t->minpre != BRACKET_DIRTY)
+        return;
+    if (bracket.size <= node)
+    {
+        int at = node - bracket.size;
+        struct bracketNode empty = {0, 0, 0};
+        *t = at < bracket.n ? editorBracketRow(&E.row[at]) : empty;
+        return;
+    }
+    editorBracketClean(2 * node);
+    editorBracketClean(2 * node + 1);
+    *t = editorBracketCombine(bracket.t[2 * node], bracket.t[2 * node + 1]);
+}
+
+// build the tree on first use and bring it up to date
+void editorBracketSync()
+{
+    if (bracket.t == NULL)
+    {
+        editorBracketReserve(E.numrows);
+        bracket.n = E.numrows;
+    }
+    if (bracket.stale)
+    {
+        for (int i = 1; i < bracket.size; i++)
+            bracket.t[i].minpre = BRACKET_DIRTY;
+        bracket.stale = 0;
+    }
+    editorBracketClean(1);
+}
+
+// first row from on where depth d, carried in from above, drops to zero
+int editorBracketForward(int node, int lo, int hi, int from, int *d)
+{
+    struct bracketNode *t = &bracket.t[node];
+    if (hi <= from)
+        return -1;
+    if (from <= lo && 0 < *d + t->minpre)
+    {
+        *d += t->net;
+        return -1;
+    }
+    if (hi - lo == 1)
+        return lo;
+    int mid = (lo + hi) / 2;
+    int at = editorBracketForward(2 * node, lo, mid, from, d);
+    return at != -1 ? at : editorBracketForward(2 * node + 1, mid, hi, from, d);
+}
+
+// last row up to to where d closers, carried in from below, find their opener
+int editorBracketBackward(int node, int lo, int hi, int to, int *d)
+{
+    struct bracketNode *t = &bracket.t[node];
+    if (to < lo)
+        return -1;
+    if (hi - 1 <= to && 0 < *d - t->maxsuf)
+    {
+        *d -= t->net;
+        return -1;
+    }
+    if (hi - lo == 1)
+        return lo;
+    int mid = (lo + hi) / 2;
+    int at = editorBracketBackward(2 * node + 1, mid, hi, to, d);
+    return at != -1 ? at : editorBracketBackward(2 * node, lo, mid, to, d);
+}
+
+// the bracket at which depth d reaches zero reading from cx in row at,
+// forward (dir 1) or backward (dir -1), not counting cx itself; returns
+// its row and sets mcx, or -1
+int editorBracketFind(int at, int cx, int dir, int d, int *mcx)
+{
+    while (1)
+    {
+        erow *row = &E.row[at];
+        int n = editorRowBrackets(row);
+        for (int k = dir < 0 ? n - 1 : 0; 0 <= k && k < n; k += dir)
+        {
+            int j = bracket.list[k];
+            if ((0 < dir && j <= cx) || (dir < 0 && cx <= j))
+                continue;
+            d += (editorBracketOpens(row->chars[j]) ? 1 : -1) * dir;
+            if (d == 0)
+            {
+                *mcx = j;
+                return at;
+            }
+        }
+        editorBracketSync();
+        if (0 < dir)
+            at = editorBracketForward(1, 0, bracket.size, at + 1, &d);
+        else
+            at = editorBracketBackward(1, 0, bracket.size, at - 1, &d);
+        if (at == -1 || E.numrows <= at)
+            return -1;
+        cx = dir < 0 ? E.row[at].size : -1; // the whole row
+    }
+}
+
+// the bracket matching the one at cx in row at, or the opener of the block
+// around cx when that isn't a bracket
+int editorBracketMatch(int at, int cx, int *mcx)
+{
+    char c = cx < E.row[at].size ? E.row[at].chars[cx] : '\0';
+    if (editorBracketOpens(c))
+        return editorBracketFind(at, cx, 1, 1, mcx);
+    if (editorBracketCloses(c))
+        return editorBracketFind(at, cx, -1, 1, mcx);
+    return editorBracketFind(at, cx, -1, 1, mcx);
+}
+
+// whether cx in row at is a bracket the lexer counts
+int editorBracketAt(int at, int cx)
+{
+    erow *row = &E.row[at];
+    if (cx >= row->size || (!editorBracketOpens(row->chars[cx]) && !editorBracketCloses(row->chars[cx])))
+        return 0;
+    int n = editorRowBrackets(row);
+    for (int k = 0; k < n; k++)
+        if (bracket.list[k] == cx)
+            return 1;
+    return 0;
+}
+
+// Ctrl-B: to the matching bracket, or to the opener of the enclosing block
+void editorBracketJump()
+{
+    if (view.fd != -1 || E.numrows <= E.cy)
+        return;
+    int cx;
+    int at = editorBracketAt(E.cy, E.cx) ? editorBracketMatch(E.cy, E.cx, &cx)
+                                         : editorBracketFind(E.cy, E.cx, -1, 1, &cx);
+    if (at == -1)
+    {
+        editorSetStatusMessage("No matching bracket");
+        return;
+    }
+    E.cy = at;
+    E.cx = cx;
+}
+
+// pick the pair drawn as HL_MATCH: the cursor's bracket and its match, or
+// the brackets of the block around the cursor
+void editorBracketMarks()
+{
+    bracket.mark_row[0] = bracket.mark_row[1] = -1;
+    if (view.fd != -1 || E.numrows <= E.cy || E.row[E.cy].lr)
+        return; // long rows would be lexed in full every frame
+
+    int row[2], cx[2];
+    row[0] = E.cy;
+    cx[0] = E.cx;
+    if (editorBracketAt(E.cy, E.cx))
+    {
+        row[1] = editorBracketMatch(E.cy, E.cx, &cx[1]);
+    }
+    else
+    {
+        row[0] = editorBracketFind(E.cy, E.cx, -1, 1, &cx[0]);
+        row[1] = row[0] == -1 ? -1 : editorBracketFind(row[0], cx[0], 1, 1, &cx[1]);
+    }
+    if (row[0] == -1 || row[1] == -1)
+        return;
+    for (int k = 0; k < 2; k++)
+    {
+        bracket.mark_row[k] = row[k];
+        bracket.mark_rx[k] = editorRowCxToRx(&E.row[row[k]], cx[k]);
+    }
+}
+
+/*** folding ***/
+
+// Ctrl-O folds the block opened on the cursor row, by braces in C-like
+// text or by indentation otherwise, and unfolds it again. Only the
+// outermost folds are kept: folding around existing folds absorbs them.
+// Drawing and vertical movement step from a fold's first row straight past
+// its end, and anything that puts the cursor on a hidden row (find, go to
+// line, an edit merging into one) unfolds what hides it.
+
+// the fold starting at or before row at, or -1
+int editorFoldAt(int at)
+{
+    int lo = 0;
+    int hi = fold.n;
+    while (lo < hi)
+    {
+        int mid = (lo + hi) / 2;
+        if (fold.r[mid].start <= at)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo - 1;
+}
+
+int editorFoldHidden(int at)
+{
+    int i = editorFoldAt(at);
+    return 0 <= i && fold.r[i].start < at && at <= fold.r[i].end;
+}
+
+// screen row of row at counting from the top of the buffer; hidden rows
+// map to the row they are folded under
+int editorFoldVisible(int at)
+{
+    int i = editorFoldAt(at);
+    if (i < 0)
+        return at;
+    int end = at < fold.r[i].end ? at : fold.r[i].end;
+    return at - fold.hidden[i] - (end - fold.r[i].start);
+}
+
+// the row shown at screen row v counting from the top of the buffer
+int editorFoldRow(int v)
+{
+    int lo = 0;
+    int hi = fold.n;
+    while (lo < hi)
+    {
+        int mid = (lo + hi) / 2;
+        if (fold.r[mid].start - fold.hidden[mid] <= v)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    int i = lo - 1;
+    if (i < 0)
+        return v;
+    if (v == fold.r[i].start - fold.hidden[i])
+        return fold.r[i].start;
+    return v + fold.hidden[i] + fold.r[i].end - fold.r[i].start;
+}
+
+// the visible rows after and before row at
+int editorFoldNext(int at)
+{
+    int i = editorFoldAt(at);
+    if (0 <= i && fold.r[i].start == at)
+        return fold.r[i].end + 1;
+    return at + 1;
+}
+
+int editorFoldPrev(int at)
+{
+    int i = editorFoldAt(at - 1);
+    if (0 <= i && fold.r[i].start < at - 1 && at - 1 <= fold.r[i].end)
+        return fold.r[i].start;
+    return at - 1;
+}
+
+void editorFoldIndex()
+{
+    int hidden = 0;
+    for (int i = 0; i < fold.n; i++)
+    {
+        fold.hidden[i] = hidden;
+        hidden += fold.r[i].end - fold.r[i].start;
+    }
+}
+
+// recount the screen lines of rows whose folding changed
+void editorFoldWrap(int start, int end)
+{
+    if (!wrap.enabled)
+        return;
+    for (int j = start; j <= end && j < E.numrows; j++)
+        editorWrapRow(&E.row[j]);
+}
+
+void editorFoldAdd(int start, int end)
+{
+    int i = editorFoldAt(start);
+    if (i < 0 || fold.r[i].start < start)
+        i++; // insert after the last fold before start
+    int j = i;
+    for (; j < fold.n && fold.r[j].start <= end; j++)
+    {
+        // folds starting inside the new one are absorbed, along with all they hide
+        if (end < fold.r[j].end)
+            end = fold.r[j].end;
+    }
+    if (i == j)
+    {
+        if (fold.cap <= fold.n)
+        {
+            fold.cap = fold.cap ? fold.cap * 2 : 16;
+            fold.r = memRealloc(MEM_FOLD, fold.r, sizeof(struct foldRange) * fold.cap);
+            fold.hidden = memRealloc(MEM_FOLD, fold.hidden, sizeof(int) * fold.cap);
+        }
+        memmove(&fold.r[i + 1], &fold.r[i], sizeof(struct foldRange) * (fold.n - i));
+        fold.n++;
+    }
+    else
+    {
+        memmove(&fold.r[i + 1], &fold.r[j], sizeof(struct foldRange) * (fold.n - j));
+        fold.n -= j - i - 1;
+    }
+    fold.r[i].start = start;
+    fold.r[i].end = end;
+    editorFoldIndex();
+    editorFoldWrap(start + 1, end);
+}
+
+void editorFoldRemove(int i)
+{
+    struct foldRange r = fold.r[i];
+    memmove(&fold.r[i], &fold.r[i + 1], sizeof(struct foldRange) * (fold.n - i - 1));
+    fold.n--;
+    editorFoldIndex();
+    editorFoldWrap(r.start + 1, r.end);
+}
+
+// unfold whatever hides row at
+void editorFoldReveal(int at)
+{
+    if (editorFoldHidden(at))
+        editorFoldRemove(editorFoldAt(at));
+}
+
+// ins rows were inserted at at, or -ins rows deleted from it; folds
+// below move along and a fold the change lands in is opened
+void editorFoldSplice(int at, int ins)
+{
+    if (fold.n == 0)
+        return;
+    int i = 0;
+    while (i < fold.n)
+    {
+        struct foldRange *r = &fold.r[i];
+        if (at <= r->start + (ins < 0 ? ins : 0))
+        {
+            r->start += ins;
+            r->end += ins;
+        }
+        else if (at <= r->end)
+        {
+            struct foldRange open = *r;
+            memmove(r, r + 1, sizeof(struct foldRange) * (fold.n - i - 1));
+            fold.n--;
+            editorFoldIndex();
+            editorFoldWrap(open.start < at ? open.start : at, open.end + ins);
+            continue;
+        }
+        i++;
+    }
+    editorFoldIndex();
+}
+
+// the row closing a block opened on row at or on a lone "{" just below it
+int editorFoldBraceEnd(int at)
+{
+    for (int j = at; j <= at + 1 && j < E.numrows; j++)
+    {
+        erow *row = &E.row[j];
+        int n = editorRowBrackets(row);
+        int k = 0;
+        if (j > at)
+        {
+            int lead = 0;
+            while (lead < row->size && isspace((unsigned char)row->chars[lead]))
+                lead++;
+            if (n == 0 || bracket.list[0] != lead || row->chars[lead] != '{')
+                return -1;
+        }
+        for (; k < n; k++)
+        {
+            int cx;
+            if (row->chars[bracket.list[k]] != '{')
+                continue;
+            int end = editorBracketFind(j, bracket.list[k], 1, 1, &cx);
+            if (at < end)
+                return end;
+            n = editorRowBrackets(row); // the search scanned other rows into the list
+        }
+    }
+    return -1;
+}
+
+int editorFoldIndent(erow *row)
+{
+    int col = 0;
+    for (int j = 0; j < row->size; j++)
+    {
+        if (row->chars[j] == '\t')
+            col += ZILO_TAB_STOP - col % ZILO_TAB_STOP;
+        else if (row->chars[j] == ' ')
+            col++;
+        else
+            return col;
+    }
+    return -1; // blank
+}
+
+// the last row of the run indented deeper than row at
+int editorFoldIndentEnd(int at)
+{
+    int base = editorFoldIndent(&E.row[at]);
+    int end = -1;
+    if (base < 0)
+        return -1;
+    for (int j = at + 1; j < E.numrows; j++)
+    {
+        int indent = editorFoldIndent(&E.row[j]);
+        if (0 <= indent && indent <= base)
+            break;
+        if (0 <= indent)
+            end = j;
+    }
+    return end;
+}
+
+void editorFoldToggle()
+{
+    if (view.fd != -1)
+    {
+        editorSetStatusMessage("Folding isn't available in the viewer");
+        return;
+    }
+    if (E.numrows <= E.cy)
+        return;
+    int i = editorFoldAt(E.cy);
+    if (0 <= i && fold.r[i].start == E.cy)
+    {
+        editorFoldRemove(i);
+        return;
+    }
+
+    int end = editorFoldBraceEnd(E.cy);
+    if (end <= E.cy)
+        end = editorFoldIndentEnd(E.cy);
+    if (end <= E.cy)
+    {
+        editorSetStatusMessage("Nothing to fold here");
+        return;
+    }
+    editorFoldAdd(E.cy, end);
+}
+
+/*** words ***/
+
+int editorIsWordChar(int c)
+{
+    return c < 128 && (isalnum(c) || c == '_');
+}
+
+// child c of parent, created when missing if create is set, 0 otherwise
+int editorWordChild(int parent, unsigned char c, int create)
+{
+    int prev = 0;
+    int at = words.node[parent].child;
+    while (at && words.node[at].c < c)
+    {
+        prev = at;
+        at = words.node[at].next;
+    }
+    if (at && words.node[at].c == c)
+        return at;
+    if (!create)
+        return 0;
+
+    if (words.cap <= words.n)
+    {
+        words.cap *= 2;
+        words.node = memRealloc(MEM_WORDS, words.node, sizeof(struct wordNode) * words.cap);
+    }
+    int k = words.n++;
+    words.node[k] = (struct wordNode){0, at, parent, 0, 0, c};
+    if (prev)
+        words.node[prev].next = k;
+    else
+        words.node[parent].child = k;
+    return k;
+}
+
+// count one occurrence of s in or out, keeping every best on its path current
+void editorWordAdd(const char *s, int len, int delta)
+{
+    if (len < ZILO_WORD_MIN || ZILO_WORD_MAX < len || isdigit((unsigned char)s[0]))
+        return;
+    if (words.n == 0)
+    {
+        words.cap = 1024;
+        words.node = memRealloc(MEM_WORDS, words.node, sizeof(struct wordNode) * words.cap);
+        words.node[0] = (struct wordNode){0, 0, 0, 0, 0, 0};
+        words.n = 1;
+    }
+    int k = 0;
+    for (int i = 0; i < len && (k = editorWordChild(k, s[i], 0 < delta)); i++)
+        ;
+    if (k == 0 || words.node[k].count + delta < 0)
+        return;
+    words.node[k].count += delta;
+
+    int best = words.node[k].count;
+    for (int j = k;; j = words.node[j].parent)
+    {
+        if (delta < 0)
+        {
+            // the old best below j may have been this word, so ask the children again
+            best = words.node[j].count;
+            for (int ch = words.node[j].child; ch; ch = words.node[ch].next)
+                if (best < words.node[ch].best)
+                    best = words.node[ch].best;
+        }
+        if (delta < 0 ? best == words.node[j].best : best <= words.node[j].best)
+            break;
+        words.node[j].best = best;
+        if (j == 0)
+            break;
+    }
+}
+
+// count the words overlapping chars from to to, widened to whole words, in or out
+// of the trie; edits call it on the span they change before and after changing it
+void editorWordsCount(erow *row, int from, int to, int delta)
+{
+    while (0 < from && editorIsWordChar((unsigned char)row->chars[from - 1]))
+        from--;
+    while (to < row->size && editorIsWordChar((unsigned char)row->chars[to]))
+        to++;
+    for (int i = from; i < to;)
+    {
+        while (i < to && !editorIsWordChar((unsigned char)row->chars[i]))
+            i++;
+        int start = i;
+        while (i < to && editorIsWordChar((unsigned char)row->chars[i]))
+            i++;
+        if (start < i)
+            editorWordAdd(&row->chars[start], i - start, delta);
+    }
+}
+
+void editorWordsPush(int *n, int key, int node)
+{
+    if (words.heapcap <= *n)
+    {
+        words.heapcap = words.heapcap ? words.heapcap * 2 : 256;
+        words.heap = memRealloc(MEM_WORDS, words.heap, sizeof(struct wordPick) * words.heapcap);
+    }
+    int i = (*n)++;
+    while (0 < i && words.heap[(i - 1) / 2].key < key)
+    {
+        words.heap[i] = words.heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    words.heap[i] = (struct wordPick){key, node};
+}
+
+struct wordPick editorWordsPop(int *n)
+{
+    struct wordPick top = words.heap[0];
+    struct wordPick last = words.heap[--(*n)];
+    int i = 0;
+    for (int ch; (ch = 2 * i + 1) < *n; i = ch)
+    {
+        if (ch + 1 < *n && words.heap[ch].key < words.heap[ch + 1].key)
+            ch++;
+        if (words.heap[ch].key <= last.key)
+            break;
+        words.heap[i] = words.heap[ch];
+    }
+    words.heap[i] = last;
+    return top;
+}
+
+// the max most frequent words that extend prefix, best first; subtrees are
+// opened in order of their best, so this touches little more than the answer
+int editorWordsComplete(const char *prefix, int plen, char out[][ZILO_WORD_MAX + 1], int max)
+{
+    int p = 0;
+    for (int i = 0; i < plen && words.n && (p = editorWordChild(p, prefix[i], 0)); i++)
+        ;
+    if (p == 0)
+        return 0;
+
+    int n = 0, got = 0;
+    editorWordsPush(&n, words.node[p].best, 2 * p);
+    while (n && got < max)
+    {
+        struct wordPick e = editorWordsPop(&n);
+        int k = e.node / 2;
+        if (e.node % 2)
+        {
+            int len = 0;
+            for (int j = k; j; j = words.node[j].parent)
+                len++;
+            out[got][len] = '\0';
+            for (int j = k; j; j = words.node[j].parent)
+                out[got][--len] = words.node[j].c;
+            got++;
+            continue;
+        }
+        if (k != p && words.node[k].count)
+            editorWordsPush(&n, words.node[k].count, 2 * k + 1);
+        for (int ch = words.node[k].child; ch; ch = words.node[ch].next)
+            if (words.node[ch].best)
+                editorWordsPush(&n, words.node[ch].best, 2 * ch);
+    }
+    return got;
+}
+
+void editorWordsFree()
+{
+    memFree(MEM_WORDS, words.node);
+    memFree(MEM_WORDS, words.heap);
+    words.node = NULL;
+    words.heap = NULL;
+    words.n = words.cap = words.heapcap = 0;
+    complete.n = 0;
+}
+
+/*** diff ***/
+
+// The diff view compares 64-bit hashes of lines rather than the lines. Each
+// row's hash is kept until an edit path clears it, so after a keystroke only
+// that row is hashed again, and the common head and tail of the two files
+// are skipped with a compare of one word per line before Myers' search runs
+// on what is left. Hunks are found again lazily, once per frame at most.
+
+// two words at a time in separate lanes so their multiplies overlap; never
+// 0, which marks a row to hash
+uint64_t editorDiffHash(const char *s, int len)
+{
+    uint64_t h1 = 0x9e3779b97f4a7c15ULL ^ (uint64_t)len, h2 = 0x2545f4914f6cdd1dULL;
+    int i = 0;
+    for (; i + 16 <= len; i += 16)
+    {
+        uint64_t w1, w2;
+        memcpy(&w1, &s[i], 8);
+        memcpy(&w2, &s[i + 8], 8);
+        h1 = (h1 ^ w1) * 0xff51afd7ed558ccdULL;
+        h2 = (h2 ^ w2) * 0xc4ceb9fe1a85ec53ULL;
+        h1 ^= h1 >> 32;
+        h2 ^= h2 >> 29;
+    }
+    uint64_t w1 = 0, w2 = 0;
+    int rest = len - i;
+    memcpy(&w1, &s[i], rest < 8 ? rest : 8);
+    if (8 < rest)
+        memcpy(&w2, &s[i + 8], rest - 8);
+    h1 = (h1 ^ w1) * 0xff51afd7ed558ccdULL ^ (h2 ^ w2) * 0xc4ceb9fe1a85ec53ULL;
+    h1 ^= h1 >> 33;
+    return h1 | 1;
+}
+
+// called from editorUpdateRow whenever a row's chars may have changed
+void editorDiffRow(erow *row)
+{
+    if (!diff.enabled || diff.n <= row->idx)
+        return;
+    diff.hash[row->idx] = 0;
+    diff.stale = 1;
+}
+
+// ins rows are about to be inserted at at, or -ins rows were deleted from it
+void editorDiffSplice(int at, int ins)
+{
+    if (!diff.enabled)
+        return;
+    if (0 < ins)
+    {
+        if (diff.cap < diff.n + ins)
+        {
+            while (diff.cap < diff.n + ins)
+                diff.cap = diff.cap ? diff.cap * 2 : 16;
+            diff.hash = memRealloc(MEM_DIFF, diff.hash, sizeof(uint64_t) * diff.cap);
+        }
+        memmove(&diff.hash[at + ins], &diff.hash[at], sizeof(uint64_t) * (diff.n - at));
+        memset(&diff.hash[at], 0, sizeof(uint64_t) * ins);
+    }
+    else
+    {
+        memmove(&diff.hash[at], &diff.hash[at - ins], sizeof(uint64_t) * (diff.n - at + ins));
+    }
+    diff.n += ins;
+    diff.stale = 1;
+}
+
+// hash the lines of the file on disk the way editorOpen splits them
+void editorDiffLoad()
+{
+    diff.ndisk = 0;
+    int fd = open(E.filename, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd == -1 || fstat(fd, &st) == -1)
+    {
+        if (fd != -1)
+            close(fd);
+        editorSetStatusMessage("Can't read %s, every line counts as new", E.filename);
+        return;
+    }
+    char *map = st.st_size ? mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : NULL;
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        editorSetStatusMessage("Can't map %s: %s", E.filename, strerror(errno));
+        return;
+    }
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+    int cap = 0;
+    for (char *p = map, *end = map + st.st_size; p < end;)
+    {
+        char *nl = memchr(p, '\n', end - p);
+        char *next = nl ? nl + 1 : end;
+        int len = next - p;
+        while (0 < len && (p[len - 1] == '\n' || p[len - 1] == '\r'))
+            len--;
+        if (cap <= diff.ndisk)
+        {
+            cap = cap ? cap * 2 : 1024;
+            diff.disk = memRealloc(MEM_DIFF, diff.disk, sizeof(uint64_t) * cap);
+        }
+        diff.disk[diff.ndisk++] = editorDiffHash(p, len);
+        p = next;
+    }
+    if (map)
+        munmap(map, st.st_size);
+}
+
+// rows start to end - 1 for del lines on disk, after the hunks found so far
+void editorDiffHunk(int start, int end, int del)
+{
+    struct diffHunk *last = diff.nhunk ? &diff.hunk[diff.nhunk - 1] : NULL;
+    if (last && last->end == start)
+    {
+        // nothing in common between them, so they're one change
+        last->end = end;
+        last->del += del;
+        return;
+    }
+    if (diff.hunkcap <= diff.nhunk)
+    {
+        diff.hunkcap = diff.hunkcap ? diff.hunkcap * 2 : 16;
+        diff.hunk = memRealloc(MEM_DIFF, diff.hunk, sizeof(struct diffHunk) * diff.hunkcap);
+    }
+    diff.hunk[diff.nhunk++] = (struct diffHunk){start, end, del};
+}
+
+// a point on a shortest edit path from (a0, b0) to (a1, b1), found where the
+// searches from both ends meet. Past ZILO_DIFF_COST edits the end of the
+// path that got furthest is taken instead, as long as it came through at
+// least half as many common lines as edits; returns 0 when neither did, the
+// stretch has too little in common to be worth pairing up line by line
+int editorDiffSplit(int a0, int a1, int b0, int b1, int *sx, int *sy)
+{
+    uint64_t *a = &diff.disk[a0], *b = &diff.hash[b0];
+    int n = a1 - a0, m = b1 - b0, delta = n - m;
+    int maxd = (n + m + 1) / 2 < ZILO_DIFF_COST ? (n + m + 1) / 2 : ZILO_DIFF_COST;
+    int off = maxd + 1, len = 2 * maxd + 3;
+    int *fv = diff.v, *bv = diff.v + len; // x reached on diagonal k = x - y
+    for (int i = 0; i < len; i++)
+        fv[i] = bv[i] = -1;
+    fv[off + 1] = bv[off + 1] = 0;
+    int front = delta & 1; // which search can meet the other first
+    int fstart = 0, fend = 0, bstart = 0, bend = 0; // diagonals run off the edges
+    for (int d = 0; d <= maxd; d++)
+    {
+        for (int k = -d + fstart; k <= d - fend; k += 2)
+        {
+            int x = (k == -d || (k != d && fv[off + k - 1] < fv[off + k + 1])) ? fv[off + k + 1] : fv[off + k - 1] + 1;
+            int y = x - k;
+            while (x < n && y < m && a[x] == b[y])
+                x++, y++;
+            fv[off + k] = x;
+            if (n < x)
+                fend += 2;
+            else if (m < y)
+                fstart += 2;
+            else if (front && 0 <= off + delta - k && off + delta - k < len && bv[off + delta - k] != -1 &&
+                     n - bv[off + delta - k] <= x)
+            {
+                *sx = a0 + x;
+                *sy = b0 + y;
+                return 1;
+            }
+        }
+        for (int k = -d + bstart; k <= d - bend; k += 2)
+        {
+            // the same walk over both files read backward
+            int x = (k == -d || (k != d && bv[off + k - 1] < bv[off + k + 1])) ? bv[off + k + 1] : bv[off + k - 1] + 1;
+            int y = x - k;
+            while (x < n && y < m && a[n - x - 1] == b[m - y - 1])
+                x++, y++;
+            bv[off + k] = x;
+            if (n < x)
+                bend += 2;
+            else if (m < y)
+                bstart += 2;
+            else if (!front && 0 <= off + delta - k && off + delta - k < len && fv[off + delta - k] != -1)
+            {
+                int fx = fv[off + delta - k];
+                if (n - x <= fx)
+                {
+                    *sx = a0 + fx;
+                    *sy = b0 + fx - (delta - k);
+                    return 1;
+                }
+            }
+        }
+    }
+
+    int best = 0;
+    for (int k = -maxd; k <= maxd; k++)
+    {
+        int x = fv[off + k], y = x - k;
+        if (x != -1 && x <= n && 0 <= y && y <= m && best < x + y && x + y < n + m)
+        {
+            best = x + y;
+            *sx = a0 + x;
+            *sy = b0 + y;
+        }
+        x = bv[off + k], y = x - k;
+        if (x != -1 && x <= n && 0 <= y && y <= m && best < x + y && x + y < n + m)
+        {
+            best = x + y;
+            *sx = a1 - x;
+            *sy = b1 - y;
+        }
+    }
+    return 2 * maxd <= best; // x + y is twice the common lines plus the edits
+}
+
+// the hunks between lines a0 to a1 - 1 on disk and rows b0 to b1 - 1, in order
+void editorDiffCompare(int a0, int a1, int b0, int b1)
+{
+    uint64_t *a = diff.disk, *b = diff.hash;
+    while (a0 < a1 && b0 < b1 && a[a0] == b[b0])
+        a0++, b0++;
+    while (a0 < a1 && b0 < b1 && a[a1 - 1] == b[b1 - 1])
+        a1--, b1--;
+    if (a0 == a1 && b0 == b1)
+        return;
+    int x, y;
+    if (a0 == a1 || b0 == b1 || !editorDiffSplit(a0, a1, b0, b1, &x, &y))
+    {
+        editorDiffHunk(b0, b1, a1 - a0);
+        return;
+    }
+    editorDiffCompare(a0, x, b0, y);
+    editorDiffCompare(x, a1, y, b1);
+}
+
+// bring the row hashes and the hunks up to date
+void editorDiffSync()
+{
+    if (!diff.enabled || !diff.stale)
+        return;
+    if (diff.ndisk < 0)
+        editorDiffLoad();
+    for (int j = 0; j < diff.n; j++)
+        if (diff.hash[j] == 0)
+            diff.hash[j] = editorDiffHash(E.row[j].chars, E.row[j].size);
+    diff.nhunk = 0;
+    editorDiffCompare(0, diff.ndisk, 0, diff.n);
+    diff.stale = 0;
+}
+
+// the file on disk now holds the rows
+void editorDiffSaved()
+{
+    if (!diff.enabled)
+        return;
+    diff.stale = 1;
+    editorDiffSync(); // hashes every row
+    diff.disk = memRealloc(MEM_DIFF, diff.disk, sizeof(uint64_t) * (diff.n ? diff.n : 1));
+    memcpy(diff.disk, diff.hash, sizeof(uint64_t) * diff.n);
+    diff.ndisk = diff.n;
+    diff.nhunk = 0;
+}
+
+// gutter marker of row at: + new, ~ changed, - lines removed above, _ below
+char editorDiffMark(int at)
+{
+    int lo = 0, hi = diff.nhunk;
+    while (lo < hi)
+    {
+        int mid = (lo + hi) / 2;
+        if (diff.hunk[mid].start <= at)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo == 0)
+        return ' ';
+    struct diffHunk *h = &diff.hunk[lo - 1];
+    if (at < h->end)
+        return h->del ? '~' : '+';
+    if (h->start == at)
+        return '-';
+    if (at == diff.n - 1 && lo < diff.nhunk && diff.hunk[lo].start == diff.n)
+        return '_';
+    return ' ';
+}
+
+void editorDiffToggle()
+{
+    if (view.fd != -1 || stream.codec || E.filename == NULL)
+    {
+        editorSetStatusMessage("Diff only compares a plain file opened in the editor");
+        return;
+    }
+    diff.enabled = !diff.enabled;
+    E.screencols += diff.enabled ? -ZILO_DIFF_GUTTER : ZILO_DIFF_GUTTER;
+    E.coloff = 0;
+    E.segoff = 0;
+    if (!diff.enabled)
+    {
+        memFree(MEM_DIFF, diff.hash);
+        memFree(MEM_DIFF, diff.disk);
+        memFree(MEM_DIFF, diff.hunk);
+        memFree(MEM_DIFF, diff.v);
+        diff = (struct diffState){0, 0, 0, NULL, -1, NULL, 0, 0, NULL, 0, NULL};
+        return;
+    }
+    diff.v = memRealloc(MEM_DIFF, NULL, sizeof(int) * 2 * (2 * ZILO_DIFF_COST + 3));
+    editorDiffSplice(0, E.numrows);
+    diff.ndisk = -1;
+    editorDiffSync();
+    editorSetStatusMessage("%d changes against %s | Ctrl-J/Ctrl-K = next/previous change", diff.nhunk, E.filename);
+}
+
+// move to the next change below the cursor, or above it if dir is negative
+void editorDiffJump(int dir)
+{
+    if (!diff.enabled)
+    {
+        editorSetStatusMessage("Ctrl-E shows the changes against the file first");
+        return;
+    }
+    editorDiffSync();
+    int i = 0;
+    while (i < diff.nhunk && diff.hunk[i].start <= E.cy)
+        i++; // the first change below the cursor
+    if (dir < 0)
+    {
+        // the change holding the cursor doesn't count
+        i--;
+        if (0 <= i && diff.hunk[i].start <= E.cy && E.cy < diff.hunk[i].end)
+            i--;
+        if (0 <= i && diff.hunk[i].start == E.cy)
+            i--;
+    }
+    if (i < 0 || diff.nhunk <= i)
+    {
+        editorSetStatusMessage("No more changes %s", dir < 0 ? "above" : "below");
+        return;
+    }
+    struct diffHunk *h = &diff.hunk[i];
+    E.cy = h->start;
+    E.cx = 0;
+    E.rowoff = E.numrows;
+    editorFoldReveal(E.cy);
+    editorSetStatusMessage("Change %d of %d: %d lines for %d on disk", i + 1, diff.nhunk, h->end - h->start, h->del);
+}
+
+/*** row operations ***/
+
+// Tabs and non-ASCII chars are the only chars that aren't exactly one byte
+// and one column wide, so their positions and widths alone describe the
+// whole cx <-> rx mapping of a row. Each of them gets a stop recording
+// where it starts in chars and the render column just past it.
+
+int editorStopLen(erow *row, tabstop *t)
+{
+    unsigned int cp;
+    return t->mb ? utf8Decode(&row->chars[t->cx], row->size - t->cx, &cp) : 1;
+}
+
+// index of the first stop at or after cx
+int editorRowStopAt(erow *row, int cx)
+{
+    int lo = 0;
+    int hi = row->nts;
+    while (lo < hi)
+    {
+        int mid = (lo + hi) / 2;
+        if ((int)row->ts[mid].cx < cx)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+// render column where stop i starts
+int editorRowStopRx(erow *row, int i)
+{
+    if (i == 0)
+        return row->ts[0].cx;
+    tabstop *t = &row->ts[i - 1];
+    return t->rx + (row->ts[i].cx - t->cx - editorStopLen(row, t));
+}
+
+int editorRowCxToRx(erow *row, int cx)
+{
+    int i = editorRowStopAt(row, cx);
+    if (i == 0)
+        return cx;
+
+    tabstop *t = &row->ts[i - 1];
+    int end = t->cx + editorStopLen(row, t);
+    if (cx < end)
+        return editorRowStopRx(row, i - 1); // inside a multibyte char
+    return t->rx + (cx - end);
+}
+
+int editorRowRxToCx(erow *row, int rx)
+{
+    // count the stops ending at or before rx
+    int lo = 0;
+    int hi = row->nts;
+    while (lo < hi)
+    {
+        int mid = (lo + hi) / 2;
+        if (row->ts[mid].rx <= rx)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    int cx = rx;
+    if (lo)
+    {
+        tabstop *t = &row->ts[lo - 1];
+        cx = t->cx + editorStopLen(row, t) + (rx - t->rx);
+    }
+    if (lo < row->nts && (int)row->ts[lo].cx <= cx)
+        cx = row->ts[lo].cx; // rx falls inside the next stop
+    if (row->size < cx)
+        cx = row->size;
+    return cx;
+}
+
+// start of the char before cx
+int editorRowPrevChar(erow *row, int cx)
+{
+    if (cx <= 0)
+        return 0;
+    int i = editorRowStopAt(row, cx);
+    if (0 < i && cx <= (int)row->ts[i - 1].cx + editorStopLen(row, &row->ts[i - 1]))
+        return row->ts[i - 1].cx;
+    return cx - 1;
+}
+
+// start of the char after the one at cx
+int editorRowNextChar(erow *row, int cx)
+{
+    if (row->size <= cx)
+        return row->size;
+    if (!(row->chars[cx] & 0x80))
+        return cx + 1;
+    unsigned int cp;
+    return cx + utf8Decode(&row->chars[cx], row->size - cx, &cp);
+}
+
+// recompute stop ends from i on; once past `settled` they were right
+// before, so stop as soon as one comes out unchanged
+void editorRowStopsRefresh(erow *row, int i, int settled)
+{
+    for (int j = i; j < row->nts; j++)
+    {
+        tabstop *t = &row->ts[j];
+        int rx = editorRowStopRx(row, j);
+        if (t->mb)
+        {
+            unsigned int cp;
+            utf8Decode(&row->chars[t->cx], row->size - t->cx, &cp);
+            rx += unicodeWidth(cp);
+        }
+        else
+        {
+            rx += ZILO_TAB_STOP - (rx % ZILO_TAB_STOP);
+        }
+        if (settled <= j && t->rx == rx)
+            break;
+        t->rx = rx;
+    }
+}
+
+void editorRowStopsPush(tabstop **ts, int *n, int cx, int mb)
+{
+    if ((*n & (*n - 1)) == 0)
+        *ts = memRealloc(MEM_STOPS, *ts, sizeof(tabstop) * (*n ? *n * 2 : 1));
+    (*ts)[*n].cx = cx;
+    (*ts)[*n].mb = mb;
+    (*n)++;
+}
+
+// chars[at, at + removed) were replaced by `inserted` new chars
+void editorRowStopsSplice(erow *row, int at, int removed, int inserted)
+{
+    int delta = inserted - removed;
+
+    // a multibyte char starting up to 3 bytes before `at` can absorb the
+    // new bytes, anything earlier decodes as before
+    int i = editorRowStopAt(row, at - 3);
+    int from = (i < row->nts && (int)row->ts[i].cx < at) ? (int)row->ts[i].cx : at;
+    int k = editorRowStopAt(row, at + removed);
+
+    tabstop *fresh = NULL;
+    int nfresh = 0;
+    int q = from;
+    int end = at + inserted;
+    if (isAscii(&row->chars[from], end - from))
+    {
+        // nothing to decode, only look for tabs
+        char *tab;
+        while ((tab = memchr(&row->chars[q], '\t', end - q)) != NULL)
+        {
+            editorRowStopsPush(&fresh, &nfresh, tab - row->chars, 0);
+            q = tab - row->chars + 1;
+        }
+        q = end;
+    }
+
+    // decode until a char boundary of the old layout is reached again
+    while (q < row->size)
+    {
+        unsigned char c = row->chars[q];
+        if (end <= q)
+        {
+            while (k < row->nts && (int)row->ts[k].cx < q - delta)
+                k++;
+            if (c < 0x80 || (k < row->nts && (int)row->ts[k].cx == q - delta))
+                break;
+        }
+        if (c == '\t')
+        {
+            editorRowStopsPush(&fresh, &nfresh, q, 0);
+            q++;
+        }
+        else if (c < 0x80)
+        {
+            q++;
+        }
+        else
+        {
+            unsigned int cp;
+            editorRowStopsPush(&fresh, &nfresh, q, 1);
+            q += utf8Decode(&row->chars[q], row->size - q, &cp);
+        }
+    }
+    if (row->size <= q)
+        k = row->nts;
+
+    // stops [i, k) are replaced by the fresh ones, the rest shift by delta
+    for (int j = i; j < k; j++)
+        row->nmb -= row->ts[j].mb;
+    for (int j = 0; j < nfresh; j++)
+        row->nmb += fresh[j].mb;
+
+    int n = i + nfresh + (row->nts - k);
+    if (n == 0)
+    {
+        memFree(MEM_STOPS, row->ts);
+        row->ts = NULL;
+        row->nts = 0;
+        memFree(MEM_STOPS, fresh);
+        return;
+    }
+
+    int cap = 1;
+    while (cap < n)
+        cap *= 2;
+    if (row->nts < cap)
+        row->ts = memRealloc(MEM_STOPS, row->ts, sizeof(tabstop) * cap);
+    memmove(&row->ts[i + nfresh], &row->ts[k], sizeof(tabstop) * (row->nts - k));
+    for (int j = i + nfresh; j < n; j++)
+        row->ts[j].cx += delta;
+    if (nfresh)
+        memcpy(&row->ts[i], fresh, sizeof(tabstop) * nfresh);
+    row->nts = n;
+    memFree(MEM_STOPS, fresh);
+
+    editorRowStopsRefresh(row, i, i + nfresh);
+}
+
+// copy chars[cx0..cx1) to out with tabs expanded, chars[cx0] being at render column col
+int editorRowExpand(erow *row, int cx0, int cx1, int col, char *out)
+{
+    int idx = 0;
+    int j = cx0;
+    while (j < cx1)
+    {
+        unsigned char c = row->chars[j];
+        if (c == '\t')
+        {
+            out[idx++] = ' ';
+            col++;
+            while (col % ZILO_TAB_STOP != 0)
+            {
+                out[idx++] = ' ';
+                col++;
+            }
+            j++;
+        }
+        else if (c < 0x80 || row->nmb == 0)
+        {
+            out[idx++] = c;
+            col++;
+            j++;
+        }
+        else
+        {
+            unsigned int cp;
+            int n = utf8Decode(&row->chars[j], row->size - j, &cp);
+            memcpy(&out[idx], &row->chars[j], n);
+            idx += n;
+            col += unicodeWidth(cp);
+            j += n;
+        }
+    }
+    out[idx] = '\0';
+    return idx;
+}
+
+void editorUpdateRow(erow *row)
+{
+    editorWrapRow(row);
+    editorDiffRow(row);
+    if (ZILO_LONG_LINE <= row->size)
+    {
+        if (row->lr == NULL)
+        {
+            row->lr = memRealloc(MEM_LONG, NULL, sizeof(struct longRow));
+            memset(row->lr, 0, sizeof(struct longRow));
+        }
+        editorLongExpand(row, row->lr->roff);
+        editorUpdateSyntax(row);
+        return;
+    }
+    editorLongFree(row);
+
+    int tabs = row->nts - row->nmb;
+
+    if (row->render == row->chars)
+        row->render = NULL;
+
+    if (tabs == 0)
+    {
+        // nothing to expand, so render shares the chars buffer
+        slabFree(MEM_RENDER, row->render, row->rcap);
+        row->rcap = 0;
+        row->render = row->chars;
+        row->rsize = row->size;
+        editorUpdateSyntax(row);
+        return;
+    }
+
+    int need = row->size + tabs * (ZILO_TAB_STOP - 1) + 1;
+    if (row->render == NULL || row->rcap < need)
+    {
+        slabFree(MEM_RENDER, row->render, row->rcap);
+        row->render = slabAlloc(MEM_RENDER, need, &row->rcap);
+    }
+    row->rsize = editorRowExpand(row, 0, row->size, 0, row->render);
+
+    editorUpdateSyntax(row);
+}
+
+// set up row idx around chars, which it takes ownership of
+void editorRowInit(erow *row, int idx, char *chars, size_t len, int cap)
+{
+    row->idx = idx;
+
+    row->size = len;
+    row->cap = cap;
+    row->chars = chars;
+    row->chars[len] = '\0';
+
+    row->rsize = 0;
+    row->rcap = 0;
+    row->render = NULL;
+    row->nhl = 0;
+    row->hl = NULL;
+    row->nts = 0;
+    row->nmb = 0;
+    row->ts = NULL;
+    row->lr = NULL;
+    row->hl_open_comment = 0;
+    editorRowStopsSplice(row, 0, 0, len);
+}
+
+// take ownership of a chars buffer of the given capacity as a new row
+void editorInsertRowBuffer(int at, char *chars, size_t len, int cap)
+{
+    if (at < 0 || E.numrows < at)
+        return;
+
+    if (E.rowcap <= E.numrows)
+    {
+        double t = perfStart();
+        E.rowcap = E.rowcap ? E.rowcap * 2 : 16;
+        E.row = memRealloc(MEM_ROWS, E.row, sizeof(erow) * E.rowcap);
+        perfStop(PERF_ALLOC, t);
+    }
+    memmove(&E.row[at + 1], &E.row[at], sizeof(erow) * (E.numrows - at));
+    for (int j = at + 1; j <= E.numrows; j++)
+        E.row[j].idx++;
+
+    editorWrapSplice(at, 1);
+    editorDiffSplice(at, 1);
+    editorBracketSplice(at, 1);
+    editorOutlineSplice(at, 1);
+    editorRowInit(&E.row[at], at, chars, len, cap);
+    editorWordsCount(&E.row[at], 0, len, 1);
+    editorUpdateRow(&E.row[at]);
+
+    E.numrows++;
+    editorFoldSplice(at, 1);
+    E.dirty++;
+}
+
+void editorInsertRow(int at, char *s, size_t len)
+{
+    if (at < 0 || E.numrows < at)
+        return;
+
+    int cap;
+    char *chars = slabAlloc(MEM_CHARS, len + 1, &cap);
+    memcpy(chars, s, len);
+    editorInsertRowBuffer(at, chars, len, cap);
+}
+
+void editorFreeRow(erow *row)
+{
+    if (row->render != row->chars)
+        slabFree(MEM_RENDER, row->render, row->rcap);
+    slabFree(MEM_CHARS, row->chars, row->cap);
+    memFree(MEM_HL, row->hl);
+    memFree(MEM_STOPS, row->ts);
+    editorLongFree(row);
+}
+
+void editorDelRow(int at)
+{
+    if (at < 0 || E.numrows <= at)
+        return;
+
+    editorWordsCount(&E.row[at], 0, E.row[at].size, -1);
+    editorFreeRow(&E.row[at]);
+    memmove(&E.row[at], &E.row[at + 1], sizeof(erow) * (E.numrows - at - 1));
+    for (int j = at; j < E.numrows - 1; j++)
+        E.row[j].idx--;
+    E.numrows--;
+    editorWrapSplice(at, -1);
+    editorDiffSplice(at, -1);
+    editorFoldSplice(at, -1);
+    editorBracketSplice(at, -1);
+    editorOutlineSplice(at, -1);
+    E.dirty++;
+}
+
+// replace rows at to at + del - 1 with the lines of text, moving the rows
+// below once whatever the counts; the new rows keep their chars in text,
+// which must be arena memory, and its newlines become their terminators
+void editorSpliceRows(int at, int del, char *text, size_t len)
+{
+    if (at < 0 || E.numrows < at + del)
+        return;
+    int ins = 0;
+    for (char *p = text, *end = text + len; p < end; ins++)
+    {
+        char *nl = memchr(p, '\n', end - p);
+        p = nl ? nl + 1 : end;
+    }
+    // rows of the folds the change lands in, which it opens
+    int lo = at, hi = at + ins;
+    for (int i = 0; i < fold.n; i++)
+        if (fold.r[i].start < at + del && at <= fold.r[i].end)
+        {
+            lo = fold.r[i].start < lo ? fold.r[i].start : lo;
+            hi = hi < fold.r[i].end - del + ins ? fold.r[i].end - del + ins : hi;
+        }
+
+    for (int j = at; j < at + del; j++)
+    {
+        editorWordsCount(&E.row[j], 0, E.row[j].size, -1);
+        editorFreeRow(&E.row[j]);
+    }
+    int numrows = E.numrows - del + ins;
+    if (E.rowcap < numrows)
+    {
+        double t = perfStart();
+        while (E.rowcap < numrows)
+            E.rowcap = E.rowcap ? E.rowcap * 2 : 16;
+        E.row = memRealloc(MEM_ROWS, E.row, sizeof(erow) * E.rowcap);
+        perfStop(PERF_ALLOC, t);
+    }
+    memmove(&E.row[at + ins], &E.row[at + del], sizeof(erow) * (E.numrows - at - del));
+    for (int j = at + ins; j < numrows; j++)
+        E.row[j].idx = j;
+
+    E.numrows -= del;
+    if (del)
+    {
+        editorWrapSplice(at, -del);
+        editorDiffSplice(at, -del);
+        editorBracketSplice(at, -del);
+        editorOutlineSplice(at, -del);
+    }
+    if (ins)
+    {
+        editorWrapSplice(at, ins);
+        editorDiffSplice(at, ins);
+        editorBracketSplice(at, ins);
+        editorOutlineSplice(at, ins);
+    }
+
+    char *p = text;
+    for (int j = at; j < at + ins; j++)
+    {
+        char *nl = memchr(p, '\n', text + len - p);
+        int n = (nl ? nl : text + len) - p;
+        if (n && p[n - 1] == '\r')
+            n--;
+        editorRowInit(&E.row[j], j, p, n, 0);
+        editorWordsCount(&E.row[j], 0, n, 1);
+        p = nl ? nl + 1 : text + len;
+    }
+    E.numrows = numrows;
+    // folds move once every row is in place, then what they showed is recounted
+    if (del)
+        editorFoldSplice(at, -del);
+    if (ins)
+        editorFoldSplice(at, ins);
+    editorFoldWrap(lo, hi);
+    // in order, each row's highlight starts where the one above left off;
+    // the rows below aren't rendered yet, so a comment opening mustn't ripple
+    // into them
+    for (int j = at; j < at + ins; j++)
+    {
+        E.numrows = j + 1;
+        editorUpdateRow(&E.row[j]);
+    }
+    E.numrows = numrows;
+    if (at + ins < E.numrows)
+        editorUpdateSyntax(&E.row[at + ins]);
+    E.dirty++;
+}
+
+// drop every row at once; rows loaded from disk go with their arena
+void editorFreeRows()
+{
+    for (int j = 0; j < E.numrows; j++)
+        editorFreeRow(&E.row[j]);
+    arenaFree();
+    memFree(MEM_ROWS, E.row);
+    E.row = NULL;
+    E.numrows = 0;
+    E.rowcap = 0;
+    editorWrapDrop(0, wrap.n);
+    wrap.n = 0;
+    fold.n = 0;
+    memFree(MEM_BRACKET, bracket.t); // rebuilt on the next search
+    bracket.t = NULL;
+    bracket.size = 0;
+    bracket.n = 0;
+    bracket.stale = 0;
+    editorWordsFree();
+    outline.n = 0;
+    outline.scanned = 0;
+    outline.nrun = 0;
+    diff.n = 0; // the rows come back through editorDiffSplice
+    diff.ndisk = -1;
+    diff.stale = 1;
+}
+
+void editorRowInsertChar(erow *row, int at, int c)
+{
+    if (at < 0 || row->size < at)
+        at = row->size;
+    editorWordsCount(row, at, at, -1);
+    if (row->render == row->chars)
+        row->render = NULL; // chars may move, drop the alias before it dangles
+    double t = perfStart();
+    row->chars = slabGrow(MEM_CHARS, row->chars, row->size + 1, &row->cap, row->size + 2);
+    perfStop(PERF_ALLOC, t);
+    memmove(&row->chars[at + 1], &row->chars[at], row->size - at + 1);
+    row->size++;
+    row->chars[at] = c;
+    editorWordsCount(row, at, at + 1, 1);
+    editorRowStopsSplice(row, at, 0, 1);
+    editorLongEdit(row, at, 1);
+    editorUpdateRow(row);
+    E.dirty++;
+}
+
+void editorRowAppendString(erow *row, char *s, size_t len)
+{
+    editorWordsCount(row, row->size, row->size, -1);
+    if (row->render == row->chars)
+        row->render = NULL; // chars may move, drop the alias before it dangles
+    double t = perfStart();
+    row->chars = slabGrow(MEM_CHARS, row->chars, row->size + 1, &row->cap, row->size + len + 1);
+    perfStop(PERF_ALLOC, t);
+    memcpy(&row->chars[row->size], s, len); // append s to the row
+    row->size += len;
+    row->chars[row->size] = '\0';
+    editorWordsCount(row, row->size - len, row->size, 1);
+    editorRowStopsSplice(row, row->size - len, 0, len);
+    editorLongEdit(row, row->size - len, len);
+    editorUpdateRow(row);
+    E.dirty++;
+}
+
+// remove the len bytes at at, a whole multibyte char in one update
+void editorRowDelChar(erow *row, int at, int len)
+{
+    if (at < 0 || row->size <= at || len <= 0)
+        return;
+    if (row->size - at < len)
+        len = row->size - at;
+    editorWordsCount(row, at, at + len, -1);
+    memmove(&row->chars[at], &row->chars[at + len], row->size - at - len + 1);
+    row->size -= len;
+    editorWordsCount(row, at, at, 1);
+    editorRowStopsSplice(row, at, len, 0);
+    editorLongEdit(row, at, -len);
+    editorUpdateRow(row);
+    E.dirty++;
+}
+
+// add text read from a file below the last row; partial says whether that
+// row is still waiting for its newline, before and after
+void editorAppendText(char *buf, size_t n, int *partial)
+{
+    for (char *p = buf, *end = buf + n; p < end;)
+    {
+        char *nl = memchr(p, '\n', end - p);
+        int len = (nl ? nl : end) - p;
+        if (*partial && E.numrows)
+        {
+            editorRowAppendString(&E.row[E.numrows - 1], p, len);
+        }
+        else
+        {
+            char *chars = arenaAlloc(len + 1);
+            memcpy(chars, p, len);
+            editorInsertRowBuffer(E.numrows, chars, len, 0);
+        }
+        *partial = (nl == NULL);
+
+        erow *row = &E.row[E.numrows - 1];
+        if (nl && row->size && row->chars[row->size - 1] == '\r')
+            editorRowDelChar(row, row->size - 1, 1);
+        p = nl ? nl + 1 : end;
+    }
+}
+
+/*** editor operations ***/
+
+int editorReadOnly()
+{
+    if (view.fd == -1)
+        return 0;
+    editorSetStatusMessage("Viewer is read-only");
+    return 1;
+}
+
+void editorInsertChar(int c)
+{
+    if (editorReadOnly())
+        return;
+    if (E.cy == E.numrows)
+    {
+        editorInsertRow(E.numrows, "", 0);
+    }
+    editorRowInsertChar(&E.row[E.cy], E.cx, c); // insert a character at the current cursor position
+    E.cx++;
+}
+
+void editorInsertNewline()
+{
+    if (editorReadOnly())
+        return;
+    if (E.cx == 0)
+    {
+        editorInsertRow(E.cy, "", 0);
+    }
+    else
+    {
+        erow *row = &E.row[E.cy];
+        editorInsertRow(E.cy + 1, &row->chars[E.cx], row->size - E.cx);
+        row = &E.row[E.cy];
+        int removed = row->size - E.cx;
+        editorLongEdit(row, E.cx, -removed);
+        editorWordsCount(row, E.cx, row->size, -1);
+        row->size = E.cx;
+        row->chars[row->size] = '\0';
+        editorWordsCount(row, E.cx, E.cx, 1);
+        editorRowStopsSplice(row, E.cx, removed, 0);
+        editorUpdateRow(row);
+    }
+    E.cy++;
+    E.cx = 0;
+}
+
+void editorDelChar()
+{
+    if (editorReadOnly())
+        return;
+    if (E.cy == E.numrows)
+        return;
+    if (E.cx == 0 && E.cy == 0)
+        return;
+
+    erow *row = &E.row[E.cy];
+    if (0 < E.cx)
+    {
+        // delete just left character of the cursor, all of its bytes
+        int start = editorRowPrevChar(row, E.cx);
+        editorRowDelChar(row, start, E.cx - start);
+        E.cx = start;
+    }
+    else
+    {
+        E.cx = E.row[E.cy - 1].size;
+        editorRowAppendString(&E.row[E.cy - 1], row->chars, row->size);
+        editorDelRow(E.cy);
+        E.cy--;
+    }
+}
+
+/*** compressed files ***/
+
+// gzip and zstd files go through the system's own tools over pipes. The
+// decoder fills the first screen before editorOpen returns and the rest
+// arrives from the main loop in slices, so rows show up as they decode
+// and keys are handled in between. Saving streams the rows back through
+// the encoder without joining them into one buffer.
+
+struct fileCodec *editorDetectCodec(char *filename)
+{
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1)
+        return NULL;
+    char magic[4];
+    ssize_t n = read(fd, magic, sizeof(magic));
+    close(fd);
+    for (int i = 0; i < CODECS; i++)
+        if (codecs[i].magic_len <= n && memcmp(magic, codecs[i].magic, codecs[i].magic_len) == 0)
+            return &codecs[i];
+    return NULL;
+}
+
+// run argv reading in and writing out, its complaints would garble the screen
+pid_t editorSpawn(char **argv, int in, int out)
+{
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        int null = open("/dev/null", O_WRONLY);
+        dup2(in, STDIN_FILENO);
+        dup2(out, STDOUT_FILENO);
+        if (null != -1)
+            dup2(null, STDERR_FILENO);
+        execvp(argv[0], argv);
+        _exit(127);
+    }
+    return pid;
+}
+
+int editorStreamEnd()
+{
+    int status;
+    close(stream.fd);
+    stream.fd = -1;
+    if (waitpid(stream.pid, &status, 0) == -1 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        editorSetStatusMessage("%s failed, the file may be incomplete", stream.codec->name);
+    else
+        editorSetStatusMessage("%d lines decoded from %s", E.numrows, stream.codec->name);
+    return 1;
+}
+
+// move decoded text into rows, waiting until there are want of them; past
+// that it stops after a slice so the main loop gets to the keys. Returns 1
+// if anything changed
+int editorStreamRead(int want)
+{
+    if (stream.fd == -1)
+        return 0;
+
+    int dirty = E.dirty; // what came from the file isn't an unsaved change
+    int changed = 0;
+    long taken = 0;
+    char buf[64 * 1024];
+    while (E.numrows < want || taken < ZILO_STREAM_SLICE)
+    {
+        ssize_t n = read(stream.fd, buf, sizeof(buf));
+        if (0 < n)
+        {
+            editorAppendText(buf, n, &stream.partial);
+            taken += n;
+            changed = 1;
+            continue;
+        }
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n == -1 && errno == EAGAIN)
+        {
+            if (want <= E.numrows)
+                break;
+            struct pollfd pfd = {stream.fd, POLLIN, 0};
+            poll(&pfd, 1, -1);
+            continue;
+        }
+        changed = editorStreamEnd(); // end of the data, or a read error
+        break;
+    }
+    E.dirty = dirty;
+    return changed;
+}
+
+void editorStreamStart(char *filename)
+{
+    int fds[2];
+    int file = open(filename, O_RDONLY | O_CLOEXEC);
+    if (file == -1 || pipe2(fds, O_CLOEXEC | O_NONBLOCK) == -1)
+        die("open");
+    // only the read end may be non-blocking, the decoder writes to the other
+    fcntl(fds[1], F_SETFL, 0);
+    stream.pid = editorSpawn(stream.codec->decode, file, fds[1]);
+    close(file);
+    close(fds[1]);
+    if (stream.pid == -1)
+        die("fork");
+    stream.fd = fds[0];
+    stream.partial = 0;
+
+    // without the terminal loop nothing would read the rest later
+    editorStreamRead(E.nonblock ? E.screenrows : INT_MAX);
+}
+
+// abandon a decode still in progress
+void editorStreamStop()
+{
+    if (stream.fd == -1)
+        return;
+    kill(stream.pid, SIGTERM);
+    close(stream.fd);
+    stream.fd = -1;
+    waitpid(stream.pid, NULL, 0);
+}
+
+int editorStreamCheck()
+{
+    return editorStreamRead(0);
+}
+
+int editorWriteAll(int fd, char *buf, size_t len)
+{
+    while (0 < len)
+    {
+        ssize_t n = write(fd, buf, len);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+void editorSaveStream()
+{
+    editorStreamRead(INT_MAX); // everything has to be in rows before it goes back
+
+    int fds[2];
+    int fd = open(E.filename, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1 || pipe2(fds, O_CLOEXEC) == -1)
+    {
+        if (fd != -1)
+            close(fd);
+        editorSetStatusMessage("Can't save! I/O error: %s", strerror(errno));
+        return;
+    }
+    pid_t pid = editorSpawn(stream.codec->encode, fds[0], fd);
+    close(fds[0]);
+
+    // a dying encoder must fail the save, not kill the editor
+    void (*sigpipe)(int) = signal(SIGPIPE, SIG_IGN);
+    int ok = (pid != -1);
+    long len = 0;
+    char buf[64 * 1024];
+    int used = 0;
+    for (int j = 0; ok && j < E.numrows; j++)
+    {
+        erow *row = &E.row[j];
+        if ((int)sizeof(buf) < used + row->size + 1)
+        {
+            ok = editorWriteAll(fds[1], buf, used) == 0;
+            used = 0;
+        }
+        if ((int)sizeof(buf) < row->size + 1)
+        {
+            ok = ok && editorWriteAll(fds[1], row->chars, row->size) == 0 &&
+                 editorWriteAll(fds[1], "\n", 1) == 0;
+        }
+        else
+        {
+            memcpy(buf + used, row->chars, row->size);
+            used += row->size;
+            buf[used++] = '\n';
+        }
+        len += row->size + 1;
+    }
+    ok = ok && editorWriteAll(fds[1], buf, used) == 0;
+    close(fds[1]);
+
+    int status;
+    if (pid != -1 && (waitpid(pid, &status, 0) == -1 || !WIFEXITED(status) || WEXITSTATUS(status) != 0))
+        ok = 0;
+    signal(SIGPIPE, sigpipe);
+
+    struct stat st;
+    if (ok && fstat(fd, &st) == 0)
+    {
+        E.dirty = 0;
+        editorSetStatusMessage("%ld bytes written to disk (%s, %ld compressed)",
+                               len, stream.codec->name, (long)st.st_size);
+    }
+    else
+    {
+        editorSetStatusMessage("Can't save! %s failed", stream.codec->name);
+    }
+    close(fd);
+}
+
+/*** file i/o ***/
+
+char *editorRowsToString(int *buflen)
+{
+    int totlen = 0;
+    int j;
+    for (j = 0; j < E.numrows; j++)
+        totlen += E.row[j].size + 1;
+    *buflen = totlen;
+
+    char *buf = malloc(totlen);
+    char *p = buf;
+    for (j = 0; j < E.numrows; j++)
+    {
+        memcpy(p, E.row[j].chars, E.row[j].size);
+        p += E.row[j].size; // slide pointer p on buf by the length of the row
+        *p = '\n';
+        p++;
+    }
+
+    return buf;
+}
+
+void editorOpen(char *filename)
+{
+    free(E.filename);
+    E.filename = strdup(filename);
+    editorStreamStop();
+    editorFreeRows();
+
+    editorSelectSyntaxHighlight();
+
+    stream.codec = editorDetectCodec(filename);
+    if (stream.codec)
+    {
+        editorStreamStart(filename);
+        return;
+    }
+
+    FILE *fp = fopen(filename, "r");
+    if (!fp)
+        die("fopen");
+
+    char *line = NULL;
+    size_t linecap = 0;
+    ssize_t linelen;
+
+    follow.offset = 0;
+    follow.partial = 0;
+    while ((linelen = getline(&line, &linecap, fp)) != -1)
+    {
+        follow.offset += linelen;
+        follow.partial = (line[linelen - 1] != '\n');
+        while (0 < linelen && (line[linelen - 1] == '\n' ||
+                               line[linelen - 1] == '\r'))
+            linelen--;
+
+        char *chars = arenaAlloc(linelen + 1);
+        memcpy(chars, line, linelen);
+        editorInsertRowBuffer(E.numrows, chars, linelen, 0);
+    }
+
+    free(line);
+    fclose(fp);
+    E.dirty = 0;
+}
+
+void editorSave()
+{
+    if (editorReadOnly())
+        return;
+    if (hex.map)
+    {
+        editorHexSave();
+        return;
+    }
+    if (E.filename == NULL)
+    {
+        char *name = editorPrompt("Save as: %s", NULL);
+        if (name == NULL)
+        {
+            editorSetStatusMessage("Save aborted");
+            return;
+        }
+        // E.filename is freed untracked wherever it is replaced
+        E.filename = strdup(name);
+        memFree(MEM_PROMPT, name);
+        editorSelectSyntaxHighlight();
+    }
+    if (stream.codec)
+    {
+        editorSaveStream();
+        return;
     }
 
     int len;
     char *buf = editorRowsToString(&len);
 
-    int fd = open(E.filename, O_RDWR | O_CREAT, 0644);
-    if (fd != -1)
+    int fd = open(E.filename, O_RDWR | O_CREAT, 0644);
+    if (fd != -1)
+    {
+        if (ftruncate(fd, len) != -1)
+        {
+            if (write(fd, buf, len) == len)
+            {
+                close(fd);
+                if (follow.fd != -1)
+                {
+                    // the file is what we wrote now, our own write isn't news
+                    follow.offset = len;
+                    follow.partial = (0 < len && buf[len - 1] != '\n');
+                }
+                free(buf);
+                E.dirty = 0;
+                editorDiffSaved();
+                editorSetStatusMessage("%d bytes written to disk", len);
+                return;
+            }
+        }
+        close(fd);
+    }
+    free(buf);
+    editorSetStatusMessage("Can't save! I/O errir: %s", strerror(errno));
+}
+
+/*** follow ***/
+
+// Rows are only ever appended at the end, so each one is highlighted once
+// on arrival and the load arena keeps the per-line cost to a bump.
+
+void editorFollow(char *filename)
+{
+    follow.file = open(filename, O_RDONLY);
+    follow.fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (follow.file == -1 || follow.fd == -1 ||
+        inotify_add_watch(follow.fd, filename, IN_MODIFY) == -1)
+        die("inotify");
+
+    // start at the bottom like tail -f
+    E.cy = E.numrows ? E.numrows - 1 : 0;
+    E.cx = 0;
+}
+
+// take everything written past follow.offset, returns 1 if rows changed
+int editorFollowRead()
+{
+    struct stat st;
+    if (fstat(follow.file, &st) == -1)
+        return 0;
+    if (st.st_size < follow.offset)
+    {
+        if (E.dirty)
+        {
+            editorSetStatusMessage("%s was truncated, save or reopen it to follow on", E.filename);
+            return 0; // reloading would throw away the unsaved edits
+        }
+        // truncated by log rotation, start over
+        char *filename = strdup(E.filename);
+        editorOpen(filename);
+        free(filename);
+        E.cy = E.numrows ? E.numrows - 1 : 0;
+        E.cx = 0;
+        return 1;
+    }
+
+    int dirty = E.dirty; // what came from the file isn't an unsaved change
+    int at_end = (E.numrows - 1 <= E.cy);
+    int changed = 0;
+    char buf[64 * 1024];
+    ssize_t n;
+    while ((n = pread(follow.file, buf, sizeof(buf), follow.offset)) > 0)
+    {
+        follow.offset += n;
+        changed = 1;
+        editorAppendText(buf, n, &follow.partial);
+    }
+    E.dirty = dirty;
+
+    if (changed && at_end)
+    {
+        E.cy = E.numrows - 1;
+        E.cx = 0;
+    }
+    return changed;
+}
+
+// drain pending inotify events and pick up the new bytes they announce
+int editorFollowCheck()
+{
+    if (follow.fd == -1)
+        return 0;
+
+    char events[4096];
+    int pending = 0;
+    while (read(follow.fd, events, sizeof(events)) > 0)
+        pending = 1;
+    return pending && editorFollowRead();
+}
+
+/*** line index ***/
+
+// The viewer's block offsets for a big file are saved to ".<name>.zidx"
+// beside it, so reopening skips the scan. The header ties the index to the
+// file's size, mtime and a hash of its first and last ZILO_INDEX_HASH
+// bytes. The offsets carry their own checksum and are spot-checked to land
+// after newlines.
+
+struct indexHeader
+{
+    char magic[8]; // "zilo-ix1"
+    int32_t block; // ZILO_VIEW_BLOCK when it was written
+    int32_t offsize;
+    int64_t size;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    uint64_t hash;
+    int64_t lines;
+    uint64_t sum; // of the offsets that follow
+};
+
+char *editorIndexPath(const char *filename)
+{
+    const char *base = strrchr(filename, '/');
+    int dirlen = base ? base - filename + 1 : 0;
+    base = base ? base + 1 : filename;
+
+    char *path = malloc(dirlen + strlen(base) + 7);
+    sprintf(path, "%.*s.%s.zidx", dirlen, filename, base);
+    return path;
+}
+
+uint64_t fnv1a(uint64_t h, const char *s, size_t len)
+{
+    for (size_t i = 0; i < len; i++)
+        h = (h ^ (unsigned char)s[i]) * 1099511628211ull;
+    return h;
+}
+
+// FNV-1a over both ends of the file
+uint64_t editorIndexHash(off_t size)
+{
+    uint64_t h = 14695981039346656037ull;
+    char *buf = malloc(ZILO_INDEX_HASH);
+    off_t from[2] = {0, size - ZILO_INDEX_HASH};
+    for (int i = 0; i < 2; i++)
+    {
+        if (from[i] < 0)
+            from[i] = 0;
+        ssize_t n = pread(view.fd, buf, ZILO_INDEX_HASH, from[i]);
+        if (0 < n)
+            h = fnv1a(h, buf, n);
+    }
+    free(buf);
+    return h;
+}
+
+void editorIndexHeader(struct indexHeader *h, struct stat *st)
+{
+    memset(h, 0, sizeof(*h));
+    memcpy(h->magic, "zilo-ix1", 8);
+    h->block = ZILO_VIEW_BLOCK;
+    h->offsize = sizeof(off_t);
+    h->size = st->st_size;
+    h->mtime_sec = st->st_mtim.tv_sec;
+    h->mtime_nsec = st->st_mtim.tv_nsec;
+    h->hash = editorIndexHash(st->st_size);
+}
+
+// the saved offsets for view.fd if the sidecar still matches it, else NULL
+off_t *editorIndexLoad(const char *filename, long *lines)
+{
+    struct stat st;
+    if (fstat(view.fd, &st) == -1 || st.st_size < ZILO_INDEX_MIN)
+        return NULL;
+
+    char *path = editorIndexPath(filename);
+    FILE *fp = fopen(path, "r");
+    free(path);
+    if (fp == NULL)
+        return NULL;
+
+    struct indexHeader want, got;
+    editorIndexHeader(&want, &st);
+    off_t *offsets = NULL;
+    if (fread(&got, sizeof(got), 1, fp) == 1 && memcmp(&want, &got, offsetof(struct indexHeader, lines)) == 0)
+    {
+        *lines = got.lines;
+        int n = (got.lines + ZILO_VIEW_BLOCK - 1) / ZILO_VIEW_BLOCK + 1;
+        offsets = malloc(sizeof(off_t) * n);
+        if (fread(offsets, sizeof(off_t), n, fp) != (size_t)n || offsets[n - 1] != st.st_size ||
+            fnv1a(14695981039346656037ull, (char *)offsets, sizeof(off_t) * n) != got.sum)
+        {
+            free(offsets);
+            offsets = NULL;
+        }
+        for (int i = 1; offsets && i < n - 1; i += (n + 63) / 64)
+        {
+            char c;
+            if (pread(view.fd, &c, 1, offsets[i] - 1) != 1 || c != '\n')
+            {
+                free(offsets);
+                offsets = NULL;
+            }
+        }
+    }
+    fclose(fp);
+    return offsets;
+}
+
+// best effort: a directory we can't write to just means scanning next time
+void editorIndexSave(const char *filename, off_t *offsets, long lines)
+{
+    struct stat st;
+    if (fstat(view.fd, &st) == -1 || st.st_size < ZILO_INDEX_MIN)
+        return;
+
+    struct indexHeader h;
+    editorIndexHeader(&h, &st);
+    h.lines = lines;
+    int n = (lines + ZILO_VIEW_BLOCK - 1) / ZILO_VIEW_BLOCK + 1;
+    h.sum = fnv1a(14695981039346656037ull, (char *)offsets, sizeof(off_t) * n);
+
+    char *path = editorIndexPath(filename);
+    char *tmp = malloc(strlen(path) + 5);
+    sprintf(tmp, "%s.tmp", path);
+    FILE *fp = fopen(tmp, "w");
+    if (fp)
+    {
+        int ok = fwrite(&h, sizeof(h), 1, fp) == 1 &&
+                 fwrite(offsets, sizeof(off_t), n, fp) == (size_t)n;
+        if (fclose(fp) == 0 && ok)
+            rename(tmp, path);
+        else
+            unlink(tmp);
+    }
+    free(tmp);
+    free(path);
+}
+
+/*** viewer ***/
+
+// --view keeps a file of any size on disk and materializes rows in blocks
+// of ZILO_VIEW_BLOCK lines as the cursor, the screen or a search reaches
+// them. A sparse index of block start offsets built by one scan of the
+// file lets any block be read back with a single pread. Blocks live in an
+// LRU list and the least recently used ones are freed once the rows hold
+// more than the budget. Highlighting starts each block in the comment
+// state the block above ended in when it was last loaded, so jumping deep
+// into a file may show the first lines of a block comment unhighlighted.
+
+long memLive()
+{
+    long bytes = 0;
+    for (int k = 0; k < MEM_KINDS; k++)
+        bytes += mem.bytes[k];
+    return bytes;
+}
+
+// one pass over the file for the line count and where every block starts;
+// returns block offsets with the file size appended
+off_t *editorViewScan(long *lines)
+{
+    int cap = 1024;
+    off_t *offsets = malloc(sizeof(off_t) * cap);
+    int n = 1;
+    offsets[0] = 0;
+    *lines = 0;
+    off_t pos = 0;
+    char last = '\n';
+    char *buf = malloc(1 << 20);
+    ssize_t len;
+    while ((len = pread(view.fd, buf, 1 << 20, pos)) > 0)
+    {
+        for (char *p = buf, *end = buf + len; (p = memchr(p, '\n', end - p)) != NULL; p++)
+        {
+            if (++*lines % ZILO_VIEW_BLOCK)
+                continue;
+            if (n == cap)
+                offsets = realloc(offsets, sizeof(off_t) * (cap *= 2));
+            offsets[n++] = pos + (p - buf) + 1;
+        }
+        pos += len;
+        last = buf[len - 1];
+    }
+    free(buf);
+    if (last != '\n')
+        (*lines)++; // the last line has no newline
+
+    int nblocks = (*lines + ZILO_VIEW_BLOCK - 1) / ZILO_VIEW_BLOCK;
+    offsets = realloc(offsets, sizeof(off_t) * (nblocks + 1));
+    offsets[nblocks] = pos;
+    return offsets;
+}
+
+void editorView(char *filename, long budget)
+{
+    free(E.filename);
+    E.filename = strdup(filename);
+    editorSelectSyntaxHighlight();
+
+    view.fd = open(filename, O_RDONLY);
+    if (view.fd == -1)
+        die("open");
+    view.budget = budget;
+
+    long lines;
+    off_t *offsets = editorIndexLoad(filename, &lines);
+    if (offsets == NULL)
+    {
+        offsets = editorViewScan(&lines);
+        editorIndexSave(filename, offsets, lines);
+    }
+    if (INT_MAX < lines)
+    {
+        errno = EFBIG;
+        die("view");
+    }
+
+    E.numrows = lines;
+    view.nblocks = (lines + ZILO_VIEW_BLOCK - 1) / ZILO_VIEW_BLOCK;
+    view.offsets = offsets;
+    view.blocks = calloc(view.nblocks, sizeof(struct viewBlock *));
+    view.comment = calloc(view.nblocks + 1, 1);
+}
+
+// read block b raw, starts[i] is where its line i begins and starts[n] its end
+int editorViewRaw(int b, char **buf, int *starts)
+{
+    off_t from = view.offsets[b];
+    int size = view.offsets[b + 1] - from;
+    *buf = malloc(size + 1);
+    int got = 0;
+    while (got < size)
+    {
+        ssize_t r = pread(view.fd, *buf + got, size - got, from + got);
+        if (r <= 0)
+            die("pread");
+        got += r;
+    }
+
+    int n = E.numrows - b * ZILO_VIEW_BLOCK;
+    if (ZILO_VIEW_BLOCK < n)
+        n = ZILO_VIEW_BLOCK;
+    char *p = *buf;
+    for (int i = 0; i < n; i++)
+    {
+        starts[i] = p - *buf;
+        char *nl = memchr(p, '\n', size - (p - *buf));
+        p = nl ? nl + 1 : *buf + size;
+    }
+    starts[n] = size;
+    return n;
+}
+
+// length of line i of a raw block without its line ending
+int editorViewLineLen(char *buf, int *starts, int i)
+{
+    int len = starts[i + 1] - starts[i];
+    while (0 < len && (buf[starts[i] + len - 1] == '\n' || buf[starts[i] + len - 1] == '\r'))
+        len--;
+    return len;
+}
+
+void editorViewUnlink(struct viewBlock *blk)
+{
+    if (blk->prev)
+        blk->prev->next = blk->next;
+    else
+        view.mru = blk->next;
+    if (blk->next)
+        blk->next->prev = blk->prev;
+    else
+        view.lru = blk->prev;
+}
+
+void editorViewTouch(struct viewBlock *blk)
+{
+    if (view.mru == blk)
+        return;
+    if (blk->prev || blk->next || view.lru == blk)
+        editorViewUnlink(blk);
+    blk->prev = NULL;
+    blk->next = view.mru;
+    if (view.mru)
+        view.mru->prev = blk;
+    view.mru = blk;
+    if (view.lru == NULL)
+        view.lru = blk;
+}
+
+struct viewBlock *editorViewLoad(int b)
+{
+    int starts[ZILO_VIEW_BLOCK + 1];
+    char *buf;
+    int n = editorViewRaw(b, &buf, starts);
+
+    long before = memLive();
+    struct viewBlock *blk = memRealloc(MEM_ROWS, NULL, sizeof(struct viewBlock));
+    blk->b = b;
+    blk->n = n;
+    blk->rows = memRealloc(MEM_ROWS, NULL, sizeof(erow) * n);
+    blk->prev = NULL;
+    blk->next = NULL;
+    for (int i = 0; i < n; i++)
+    {
+        int len = editorViewLineLen(buf, starts, i);
+        int cap;
+        char *chars = slabAlloc(MEM_CHARS, len + 1, &cap);
+        memcpy(chars, &buf[starts[i]], len);
+        editorRowInit(&blk->rows[i], b * ZILO_VIEW_BLOCK + i, chars, len, cap);
+        editorUpdateRow(&blk->rows[i]);
+    }
+    free(buf);
+    view.comment[b + 1] = blk->rows[n - 1].hl_open_comment;
+
+    blk->bytes = memLive() - before;
+    view.used += blk->bytes;
+    view.blocks[b] = blk;
+    return blk;
+}
+
+// drop least recently used blocks until the rows fit the budget, always
+// keeping the two most recent so pointers just handed out stay valid
+void editorViewEvict()
+{
+    while (view.budget < view.used && view.lru && view.lru != view.mru &&
+           view.lru != view.mru->next)
+    {
+        struct viewBlock *blk = view.lru;
+        editorViewUnlink(blk);
+        for (int i = 0; i < blk->n; i++)
+            editorFreeRow(&blk->rows[i]);
+        memFree(MEM_ROWS, blk->rows);
+        view.blocks[blk->b] = NULL;
+        view.used -= blk->bytes;
+        memFree(MEM_ROWS, blk);
+    }
+}
+
+// the row for line at; in the viewer this may read it back from disk and
+// evict rows that weren't used recently
+erow *editorRow(int at)
+{
+    if (view.fd == -1)
+        return &E.row[at];
+
+    int b = at / ZILO_VIEW_BLOCK;
+    struct viewBlock *blk = view.blocks[b] ? view.blocks[b] : editorViewLoad(b);
+    editorViewTouch(blk);
+    editorViewEvict();
+    return &blk->rows[at % ZILO_VIEW_BLOCK];
+}
+
+// find the next line after from, going in direction and wrapping around,
+// that contains query, by reading the file rather than materializing rows
+int editorViewFind(char *query, int from, int direction, int *cx)
+{
+    int starts[ZILO_VIEW_BLOCK + 1];
+    char *buf = NULL;
+    int loaded = -1;
+    int qlen = strlen(query);
+    int line = from;
+    for (int i = 0; i < E.numrows; i++)
+    {
+        line += direction;
+        if (line < 0)
+            line = E.numrows - 1;
+        else if (line == E.numrows)
+            line = 0;
+
+        int b = line / ZILO_VIEW_BLOCK;
+        if (b != loaded)
+        {
+            free(buf);
+            editorViewRaw(b, &buf, starts);
+            loaded = b;
+        }
+        int j = line % ZILO_VIEW_BLOCK;
+        char *s = &buf[starts[j]];
+        char *match = memmem(s, editorViewLineLen(buf, starts, j), query, qlen);
+        if (match)
+        {
+            *cx = match - s;
+            free(buf);
+            return line;
+        }
+    }
+    free(buf);
+    return -1;
+}
+
+/*** hex ***/
+
+// Binary files are mapped rather than read into rows, so opening or
+// scrolling through one costs the same at any size: a frame formats only
+// the bytes on screen. Overwriting a byte makes its page writable, which
+// copies just that page, and saving writes the marked pages back in place.
+// The size never changes, there is no inserting or deleting.
+
+// hex digits of n bytes, two per byte, 16 (or 8) bytes at a time
+void hexEncode(const unsigned char *in, int n, char *out)
+{
+    static const char digits[] = "0123456789abcdef";
+    int i = 0;
+#ifdef __SSE2__
+    const __m128i low = _mm_set1_epi8(0x0f);
+    const __m128i nine = _mm_set1_epi8(9);
+    const __m128i zero = _mm_set1_epi8('0');
+    const __m128i gap = _mm_set1_epi8('a' - '0' - 10);
+    for (; i + 16 <= n; i += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)&in[i]);
+        __m128i hi = _mm_and_si128(_mm_srli_epi16(v, 4), low);
+        __m128i lo = _mm_and_si128(v, low);
+        // '0' plus the nibble, and the gap up to 'a' for the ones over 9
+        hi = _mm_add_epi8(_mm_add_epi8(hi, zero), _mm_and_si128(_mm_cmpgt_epi8(hi, nine), gap));
+        lo = _mm_add_epi8(_mm_add_epi8(lo, zero), _mm_and_si128(_mm_cmpgt_epi8(lo, nine), gap));
+        _mm_storeu_si128((__m128i *)&out[2 * i], _mm_unpacklo_epi8(hi, lo));
+        _mm_storeu_si128((__m128i *)&out[2 * i + 16], _mm_unpackhi_epi8(hi, lo));
+    }
+#elif defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    for (; i + 8 <= n; i += 8)
+    {
+        uint64_t w;
+        memcpy(&w, &in[i], 8);
+        uint64_t hi = (w >> 4) & 0x0f0f0f0f0f0f0f0fULL;
+        uint64_t lo = w & 0x0f0f0f0f0f0f0f0fULL;
+        // adding 6 carries into bit 4 of the nibbles over 9
+        hi += 0x3030303030303030ULL + (((hi + 0x0606060606060606ULL) >> 4) & 0x0101010101010101ULL) * ('a' - '0' - 10);
+        lo += 0x3030303030303030ULL + (((lo + 0x0606060606060606ULL) >> 4) & 0x0101010101010101ULL) * ('a' - '0' - 10);
+        // spread 4 bytes to every other byte and put the low digits between
+        for (int half = 0; half < 2; half++)
+        {
+            uint64_t h = (hi >> (32 * half)) & 0xffffffffULL;
+            uint64_t l = (lo >> (32 * half)) & 0xffffffffULL;
+            h = (h | h << 16) & 0x0000ffff0000ffffULL;
+            h = (h | h << 8) & 0x00ff00ff00ff00ffULL;
+            l = (l | l << 16) & 0x0000ffff0000ffffULL;
+            l = (l | l << 8) & 0x00ff00ff00ff00ffULL;
+            uint64_t pair = h | l << 8;
+            memcpy(&out[2 * i + 8 * half], &pair, 8);
+        }
+    }
+#endif
+    for (; i < n; i++)
+    {
+        out[2 * i] = digits[in[i] >> 4];
+        out[2 * i + 1] = digits[in[i] & 15];
+    }
+}
+
+// a NUL among the first bytes, like grep decides
+int editorHexDetect(char *filename)
+{
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1)
+        return 0;
+    char buf[ZILO_BINARY_PROBE];
+    ssize_t n = read(fd, buf, sizeof(buf));
+    close(fd);
+    return 0 < n && memchr(buf, '\0', n) != NULL;
+}
+
+// map filename for the hex view, 0 if it's empty or can't be mapped
+int editorHex(char *filename)
+{
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1)
+        return 0;
+    struct stat st;
+    void *map = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && 0 < st.st_size)
+        map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return 0;
+
+    free(E.filename);
+    E.filename = strdup(filename);
+    hex.map = map;
+    hex.size = st.st_size;
+    hex.pagesize = sysconf(_SC_PAGESIZE);
+    hex.dirty = calloc((hex.size / hex.pagesize + 8) / 8, 1);
+    hex.readonly = access(filename, W_OK) == -1;
+    hex.digits = 8;
+    while (hex.digits < 16 && (hex.size - 1) >> (4 * hex.digits))
+        hex.digits += 2;
+    return 1;
+}
+
+// bytes per line, the most that fit the screen out of ZILO_HEX_WIDTH
+int editorHexWidth()
+{
+    int w = ZILO_HEX_WIDTH;
+    while (2 < w && E.screencols < hex.digits + 2 + w / 2 * 5 + 1 + w)
+        w /= 2;
+    return w;
+}
+
+// keep the cursor on screen and the top at the start of a line
+void editorHexScroll()
+{
+    int w = editorHexWidth();
+    off_t page = (off_t)E.screenrows * w;
+    off_t line = hex.cur - hex.cur % w;
+    hex.top -= hex.top % w;
+    if (line < hex.top)
+        hex.top = line;
+    if (hex.top + page <= line)
+        hex.top = line - page + w;
+    if (hex.top < 0)
+        hex.top = 0;
+}
+
+void editorHexGo(off_t to)
+{
+    if (hex.size <= to)
+        to = hex.size - 1;
+    if (to < 0)
+        to = 0;
+    hex.cur = to;
+    hex.nibble = 0;
+}
+
+// overwrite the byte at off; its page is made writable on the first write,
+// which gives this process its own copy of the page
+void editorHexPoke(off_t off, unsigned char b)
+{
+    off_t page = off / hex.pagesize;
+    if (!(hex.dirty[page / 8] & 1 << page % 8))
+    {
+        if (mprotect(hex.map + page * hex.pagesize, hex.pagesize, PROT_READ | PROT_WRITE) == -1)
+        {
+            editorSetStatusMessage("Can't write the page: %s", strerror(errno));
+            return;
+        }
+        hex.dirty[page / 8] |= 1 << page % 8;
+    }
+    hex.map[off] = b;
+    E.dirty++;
+}
+
+// a hex digit in the hex column sets the next half of the byte, a printable
+// char in the text column the whole byte
+void editorHexType(int c)
+{
+    if (c < 32 || 127 <= c || (!hex.ascii && !isxdigit(c)))
+        return;
+    if (hex.readonly)
+    {
+        editorSetStatusMessage("File is read-only");
+        return;
+    }
+    unsigned char b = hex.map[hex.cur];
+    if (hex.ascii)
+    {
+        b = c;
+    }
+    else
+    {
+        int v = isdigit(c) ? c - '0' : tolower(c) - 'a' + 10;
+        b = hex.nibble ? (b & 0xf0) | v : v << 4 | (b & 0x0f);
+        hex.nibble = !hex.nibble;
+    }
+    editorHexPoke(hex.cur, b);
+    if (!hex.nibble)
+        editorHexGo(hex.cur + 1);
+}
+
+// write the pages with overwritten bytes back, a run of them at a time
+void editorHexSave()
+{
+    int fd = open(E.filename, O_WRONLY);
+    if (fd == -1)
+    {
+        editorSetStatusMessage("Can't save! I/O error: %s", strerror(errno));
+        return;
+    }
+    off_t pages = (hex.size + hex.pagesize - 1) / hex.pagesize;
+    long long written = 0;
+    for (off_t p = 0; p < pages; p++)
+    {
+        if (!(hex.dirty[p / 8] & 1 << p % 8))
+            continue;
+        off_t end = p;
+        while (end < pages && hex.dirty[end / 8] & 1 << end % 8)
+            end++;
+        off_t from = p * hex.pagesize;
+        off_t to = end * hex.pagesize < hex.size ? end * hex.pagesize : hex.size;
+        if (pwrite(fd, hex.map + from, to - from, from) != to - from)
+        {
+            editorSetStatusMessage("Can't save! I/O error: %s", strerror(errno));
+            close(fd);
+            return;
+        }
+        // back to read-only, so the next write marks the page again
+        mprotect(hex.map + from, (end - p) * hex.pagesize, PROT_READ);
+        for (; p < end; p++)
+            hex.dirty[p / 8] &= ~(1 << p % 8);
+        written += to - from;
+    }
+    close(fd);
+    E.dirty = 0;
+    editorSetStatusMessage("%lld bytes written to disk", written);
+}
+
+// the bytes a search is for: hex digit pairs, spaces between them optional,
+// or text after a leading "; returns how many, 0 if the pattern is malformed
+int editorHexPattern(char *query, unsigned char *pat)
+{
+    if (query[0] == '"')
+    {
+        int n = strlen(query + 1);
+        memcpy(pat, query + 1, n);
+        return n;
+    }
+    int n = 0;
+    for (char *s = query; *s; s++)
+    {
+        if (*s == ' ')
+            continue;
+        if (!isxdigit((unsigned char)s[0]) || !isxdigit((unsigned char)s[1]))
+            return 0;
+        char pair[3] = {s[0], s[1], '\0'};
+        pat[n++] = strtol(pair, NULL, 16);
+        s++;
+    }
+    return n;
+}
+
+// where the n bytes of pat start nearest from, at or past it going forward
+// or at or before it going back, wrapping around the end once; -1 if nowhere
+off_t editorHexSearch(unsigned char *pat, int n, off_t from, int direction)
+{
+    if (n == 0 || hex.size < n)
+        return -1;
+    off_t last = hex.size - n;
+    if (from < 0 || last < from)
+        from = direction == 1 ? 0 : last;
+    if (direction == 1)
+    {
+        unsigned char *m = memmem(hex.map + from, hex.size - from, pat, n);
+        if (m == NULL && 0 < from)
+            m = memmem(hex.map, from + n - 1, pat, n);
+        return m ? m - hex.map : -1;
+    }
+    // back through from..0, then last..from + 1
+    for (int pass = 0; pass < 2; pass++)
+    {
+        off_t lo = pass ? from + 1 : 0;
+        off_t end = (pass ? last : from) + 1;
+        while (lo < end)
+        {
+            unsigned char *p = memrchr(hex.map + lo, pat[0], end - lo);
+            if (p == NULL)
+                break;
+            if (memcmp(p, pat, n) == 0)
+                return p - hex.map;
+            end = p - hex.map;
+        }
+    }
+    return -1;
+}
+
+// arrows go to the next or previous match, Enter to the first one
+void editorHexFindCallback(char *query, int key)
+{
+    int direction = 1;
+    if (key == ARROW_LEFT || key == ARROW_UP)
+        direction = -1;
+    else if (key == '\r' && hex.match != -1)
+        return;
+    else if (key != '\r' && key != ARROW_RIGHT && key != ARROW_DOWN)
+    {
+        hex.match = -1; // the pattern changed, the next search starts over
+        return;
+    }
+
+    unsigned char *pat = malloc(strlen(query) + 1);
+    int n = editorHexPattern(query, pat);
+    if (n == 0)
+    {
+        editorSetStatusMessage("Not a byte pattern: %s", query);
+        free(pat);
+        return;
+    }
+    off_t from = hex.match == -1 ? hex.cur : hex.match + direction;
+    off_t m = editorHexSearch(pat, n, from, direction);
+    free(pat);
+    if (m == -1)
+    {
+        editorSetStatusMessage("Not found: %s", query);
+        return;
+    }
+    hex.match = m;
+    hex.matchlen = n;
+    editorHexGo(m);
+    // show the match mid-screen
+    int w = editorHexWidth();
+    hex.top = m - m % w - (off_t)(E.screenrows / 2) * w;
+}
+
+void editorHexFind()
+{
+    off_t saved_cur = hex.cur;
+    off_t saved_top = hex.top;
+    hex.match = -1;
+    char *query = editorPrompt("Search: %s (hex like 7f 45 4c or \"text, ESC/Arrows/Enter)", editorHexFindCallback);
+    if (query)
+    {
+        memFree(MEM_SEARCH, query);
+    }
+    else
+    {
+        hex.cur = saved_cur;
+        hex.top = saved_top;
+        hex.match = -1;
+    }
+}
+
+// an offset in decimal, 0x hex or as a percentage of the file
+void editorHexGoto()
+{
+    char *input = editorPrompt("Go to offset: %s (decimal, 0x hex or n%%, ESC to cancel)", NULL);
+    if (input == NULL)
+        return;
+    char *end;
+    long long to = strtoll(input, &end, 0);
+    if (*end == '%')
+        to = hex.size / 100 * to + hex.size % 100 * to / 100;
+    memFree(MEM_PROMPT, input);
+    editorHexGo(to);
+    int w = editorHexWidth();
+    hex.top = hex.cur - hex.cur % w - (off_t)(E.screenrows / 2) * w;
+}
+
+// the hex view's keys; returns 0 for the ones that work as they do on text
+int editorHexKey(int c)
+{
+    int w = editorHexWidth();
+    off_t page = (off_t)E.screenrows * w;
+    switch (c)
+    {
+    case CTRL_KEY('q'):
+    case CTRL_KEY('s'):
+    case CTRL_KEY('t'):
+    case CTRL_KEY('p'):
+    case CTRL_KEY('l'):
+        return 0;
+    case CTRL_KEY('f'):
+        editorHexFind();
+        return 1;
+    case CTRL_KEY('g'):
+        editorHexGoto();
+        return 1;
+    }
+
+    hex.match = -1;
+    switch (c)
+    {
+    case '\t':
+        hex.ascii = !hex.ascii;
+        hex.nibble = 0;
+        break;
+    case ARROW_LEFT:
+    case BACKSPACE:
+    case CTRL_KEY('h'):
+        editorHexGo(hex.nibble ? hex.cur : hex.cur - 1);
+        break;
+    case ARROW_RIGHT:
+        editorHexGo(hex.cur + 1);
+        break;
+    case ARROW_UP:
+        if (w <= hex.cur)
+            editorHexGo(hex.cur - w);
+        break;
+    case ARROW_DOWN:
+        if (hex.cur - hex.cur % w + w < hex.size)
+            editorHexGo(hex.cur + w);
+        break;
+    case PAGE_UP:
+        hex.top -= page;
+        editorHexGo(hex.cur < page ? hex.cur % w : hex.cur - page);
+        break;
+    case PAGE_DOWN:
+        hex.top += page;
+        editorHexGo(hex.cur + page);
+        break;
+    case HOME_KEY:
+        editorHexGo(hex.cur - hex.cur % w);
+        break;
+    case END_KEY:
+        editorHexGo(hex.cur - hex.cur % w + w - 1);
+        break;
+    default:
+        editorHexType(c);
+        break;
+    }
+    return 1;
+}
+
+/*** find ***/
+
+void editorFindCallback(char *query, int key)
+{
+    static int last_match = -1;
+    static int direction = 1;
+
+    E.match_row = -1;
+
+    if (key == '\r' || key == '\x1b')
+    {
+        last_match = -1;
+        direction = 1;
+        return;
+    }
+    else if (key == ARROW_RIGHT || key == ARROW_DOWN)
+    {
+        direction = 1;
+    }
+    else if (key == ARROW_LEFT || key == ARROW_UP)
+    {
+        direction = -1;
+    }
+    else
+    {
+        last_match = -1;
+        direction = 1;
+    }
+
+    if (last_match == -1)
+        direction = 1;
+
+    if (view.fd != -1)
+    {
+        int cx;
+        int line = editorViewFind(query, last_match, direction, &cx);
+        if (line != -1)
+        {
+            erow *row = editorRow(line);
+            last_match = line;
+            E.cy = line;
+            E.cx = cx;
+            E.rowoff = E.numrows;
+
+            E.match_row = line;
+            E.match_rx = editorRowCxToRx(row, cx);
+            E.match_len = editorRowCxToRx(row, cx + strlen(query)) - E.match_rx;
+        }
+        return;
+    }
+
+    int current = last_match;
+    int i;
+    for (i = 0; i < E.numrows; i++)
+    {
+        current += direction;
+        if (current == -1)
+            current = E.numrows - 1;
+        else if (current == E.numrows)
+            current = 0;
+
+        erow *row = &E.row[current];
+        int qlen = strlen(query);
+        if (row->lr || row->nmb)
+        {
+            // long rows only render a window and render offsets of
+            // non-ASCII rows aren't columns, so search their chars
+            char *match = memmem(row->chars, row->size, query, qlen);
+            if (match)
+            {
+                last_match = current;
+                E.cy = current;
+                E.cx = match - row->chars;
+                E.rowoff = E.numrows;
+
+                E.match_row = current;
+                E.match_rx = editorRowCxToRx(row, E.cx);
+                E.match_len = editorRowCxToRx(row, E.cx + qlen) - E.match_rx;
+                break;
+            }
+            continue;
+        }
+
+        char *match = strstr(row->render, query);
+        if (match)
+        {
+            last_match = current;
+            E.cy = current;
+            E.cx = editorRowRxToCx(row, match - row->render);
+            E.rowoff = E.numrows;
+
+            E.match_row = current;
+            E.match_rx = match - row->render;
+            E.match_len = qlen;
+            break;
+        }
+    }
+    if (E.match_row != -1)
+        editorFoldReveal(E.match_row);
+}
+
+void editorFind()
+{
+    int saved_cx = E.cx;
+    int saved_cy = E.cy;
+    int saved_coloff = E.coloff;
+    int saved_rowoff = E.rowoff;
+    int saved_segoff = E.segoff;
+
+    char *query = editorPrompt("Search: %s (Use ESC/Arrows/Enter)", editorFindCallback);
+    if (query)
+    {
+        memFree(MEM_SEARCH, query);
+    }
+    else
+    {
+        E.cx = saved_cx;
+        E.cy = saved_cy;
+        E.coloff = saved_coloff;
+        E.rowoff = saved_rowoff;
+        E.segoff = saved_segoff;
+    }
+}
+
+/*** goto line ***/
+
+void editorGotoLine()
+{
+    char *input = editorPrompt("Go to line: %s (ESC to cancel)", NULL);
+    if (input == NULL)
+        return;
+    long line = atol(input);
+    memFree(MEM_PROMPT, input);
+
+    // rows are indexed directly, and the viewer finds any line's block
+    // through its line index, so this never scans
+    if (E.numrows < line)
+        line = E.numrows;
+    E.cy = 0 < line ? line - 1 : 0;
+    E.cx = 0;
+    E.rowoff = E.cy - E.screenrows / 2;
+    if (E.rowoff < 0)
+        E.rowoff = 0;
+}
+
+/*** sort ***/
+
+// Sorting a range reorders the row descriptors in place: no line's text is
+// copied, and the per-row counts of wrap and diff move along with their
+// rows. Each line gets a 64-bit key, its first 8 bytes or the number it
+// starts with mapped to an integer that orders the same way, and an LSD
+// radix sort passes over the key bytes that aren't shared by every line.
+// Only lines whose first 8 bytes tie are compared as text after that, and
+// only numbers too long for a double to tell apart are compared digit by
+// digit. Lines that sort equal keep their order, and unique keeps the first.
+
+struct sortKey
+{
+    uint64_t key;
+    int idx;     // row the key was taken from
+    int inexact; // the number has more digits than its key holds
+};
+
+// the number a line starts with after blanks, as sort -n reads it: integer
+// digits without leading zeros and fraction digits without trailing ones
+struct sortNumber
+{
+    int neg;
+    const char *ip;
+    int ilen;
+    const char *fp;
+    int flen;
+};
+
+// bytes off to off + 8 of a line, big-endian so keys order like the text
+uint64_t editorSortText(erow *row, int off)
+{
+    uint64_t key = 0;
+    for (int i = off; i < off + 8; i++)
+        key = key << 8 | (i < row->size ? (unsigned char)row->chars[i] : 0);
+    return key;
+}
+
+void editorSortParse(erow *row, struct sortNumber *num)
+{
+    const char *s = row->chars, *end = row->chars + row->size;
+    while (s < end && (*s == ' ' || *s == '\t'))
+        s++;
+    num->neg = s < end && *s == '-';
+    s += num->neg;
+    while (s < end && *s == '0')
+        s++;
+    num->ip = s;
+    while (s < end && isdigit((unsigned char)*s))
+        s++;
+    num->ilen = s - num->ip;
+    num->fp = s < end && *s == '.' ? ++s : s;
+    while (s < end && isdigit((unsigned char)*s))
+        s++;
+    num->flen = s - num->fp;
+    while (0 < num->flen && num->fp[num->flen - 1] == '0')
+        num->flen--;
+    if (num->ilen == 0 && num->flen == 0)
+        num->neg = 0; // -0 sorts with 0
+}
+
+// the number a line starts with, 0 if it has none, as a double from its
+// first 20 digits; flipping the sign bit of a positive double and every
+// bit of a negative one makes the integers order like the numbers
+uint64_t editorSortNumber(erow *row, int *inexact)
+{
+    struct sortNumber num;
+    editorSortParse(row, &num);
+    char digits[21];
+    int n = 0;
+    int exp = num.ilen;
+    for (int i = 0; i < num.ilen && n < 20; i++)
+        digits[n++] = num.ip[i];
+    int i = 0;
+    if (num.ilen == 0)
+        for (; i < num.flen && num.fp[i] == '0'; i++)
+            exp--;
+    *inexact = 15 < num.ilen + num.flen - i;
+    for (; i < num.flen && n < 20; i++)
+        digits[n++] = num.fp[i];
+    char buf[48];
+    snprintf(buf, sizeof(buf), "%s0.%.*se%d", num.neg ? "-" : "", n, digits, n ? exp : 0);
+    double v = strtod(buf, NULL);
+    uint64_t key;
+    memcpy(&key, &v, sizeof(key));
+    return key >> 63 ? ~key : key | (uint64_t)1 << 63;
+}
+
+// the numbers the lines start with compared exactly: sign, integer digits,
+// then fraction digits
+int editorSortNumbers(erow *a, erow *b)
+{
+    struct sortNumber x, y;
+    editorSortParse(a, &x);
+    editorSortParse(b, &y);
+    if (x.neg != y.neg)
+        return x.neg ? -1 : 1;
+    int c = x.ilen != y.ilen ? x.ilen - y.ilen : memcmp(x.ip, y.ip, x.ilen);
+    if (c == 0)
+        c = memcmp(x.fp, y.fp, x.flen < y.flen ? x.flen : y.flen);
+    if (c == 0)
+        c = x.flen - y.flen;
+    return x.neg ? -c : c;
+}
+
+// by the bytes of the lines, then by length
+int editorSortLines(erow *a, erow *b)
+{
+    int c = memcmp(a->chars, b->chars, a->size < b->size ? a->size : b->size);
+    return c ? c : a->size - b->size;
+}
+
+// ties between rows that sort equal go to the one above
+int editorSortCompare(const void *a, const void *b)
+{
+    const struct sortKey *x = a, *y = b;
+    int c = editorSortLines(&E.row[x->idx], &E.row[y->idx]);
+    return c ? c : x->idx - y->idx;
+}
+
+int editorSortCompareReverse(const void *a, const void *b)
+{
+    const struct sortKey *x = a, *y = b;
+    int c = editorSortLines(&E.row[y->idx], &E.row[x->idx]);
+    return c ? c : x->idx - y->idx;
+}
+
+int editorSortCompareNumber(const void *a, const void *b)
+{
+    const struct sortKey *x = a, *y = b;
+    int c = editorSortNumbers(&E.row[x->idx], &E.row[y->idx]);
+    return c ? c : x->idx - y->idx;
+}
+
+int editorSortCompareNumberReverse(const void *a, const void *b)
+{
+    const struct sortKey *x = a, *y = b;
+    int c = editorSortNumbers(&E.row[y->idx], &E.row[x->idx]);
+    return c ? c : x->idx - y->idx;
+}
+
+// stable LSD radix sort of n keys, tmp is scratch of the same size
+void editorSortKeys(struct sortKey *k, struct sortKey *tmp, int n)
+{
+    static int count[8][256];
+    memset(count, 0, sizeof(count));
+    for (int i = 0; i < n; i++)
+        for (int b = 0; b < 8; b++)
+            count[b][k[i].key >> (8 * b) & 255]++;
+
+    struct sortKey *src = k, *dst = tmp;
+    for (int b = 0; b < 8; b++)
+    {
+        if (n == 0 || count[b][k[0].key >> (8 * b) & 255] == n)
+            continue; // every key has this byte
+        int pos = 0;
+        for (int v = 0; v < 256; v++)
+        {
+            int c = count[b][v];
+            count[b][v] = pos;
+            pos += c;
+        }
+        for (int i = 0; i < n; i++)
+            dst[count[b][src[i].key >> (8 * b) & 255]++] = src[i];
+        struct sortKey *t = src;
+        src = dst;
+        dst = t;
+    }
+    if (src != k)
+        memcpy(k, src, sizeof(struct sortKey) * n);
+}
+
+// order the runs of keys that tie on bytes off to off + 8 of their lines:
+// by the next 8 bytes while every line of a run is that long, by comparing
+// the lines once the run is small, a line ended or the prefix got long
+void editorSortTies(struct sortKey *k, struct sortKey *tmp, int n, int off, int flags)
+{
+    for (int i = 0; i < n;)
+    {
+        int e = i + 1;
+        int deeper = off + 8 <= E.row[k[i].idx].size;
+        for (; e < n && k[e].key == k[i].key; e++)
+            deeper = deeper && off + 8 <= E.row[k[e].idx].size;
+        if (e - i < 16 || off == 64 || !deeper)
+        {
+            if (1 < e - i)
+                qsort(&k[i], e - i, sizeof(struct sortKey),
+                      flags & SORT_REVERSE ? editorSortCompareReverse : editorSortCompare);
+            i = e;
+            continue;
+        }
+        uint64_t key = k[i].key;
+        for (int j = i; j < e; j++)
+        {
+            k[j].key = editorSortText(&E.row[k[j].idx], off + 8);
+            if (flags & SORT_REVERSE)
+                k[j].key = ~k[j].key;
+        }
+        editorSortKeys(&k[i], tmp, e - i);
+        editorSortTies(&k[i], tmp, e - i, off + 8, flags);
+        // put back the keys the run tied on, repeats are found by them
+        for (int j = i; j < e; j++)
+            k[j].key = key;
+        i = e;
+    }
+}
+
+// order the runs of numeric keys that tie where one of the numbers had
+// more digits than the key could keep
+void editorSortNumberTies(struct sortKey *k, int n, int flags)
+{
+    for (int i = 0; i < n;)
+    {
+        int e = i + 1;
+        int inexact = k[i].inexact;
+        for (; e < n && k[e].key == k[i].key; e++)
+            inexact = inexact || k[e].inexact;
+        if (inexact && 1 < e - i)
+            qsort(&k[i], e - i, sizeof(struct sortKey),
+                  flags & SORT_REVERSE ? editorSortCompareNumberReverse : editorSortCompareNumber);
+        i = e;
+    }
+}
+
+// sort rows from to to by flags, or with SORT_KEEP only drop repeated lines
+void editorSortRows(int from, int to, int flags)
+{
+    int n = to - from + 1;
+    // folds in the range open, what they hid is about to move
+    for (int i = 0; i < fold.n;)
+        if (fold.r[i].start <= to && from <= fold.r[i].end)
+            editorFoldRemove(i);
+        else
+            i++;
+
+    struct sortKey *k = memRealloc(MEM_ROWS, NULL, sizeof(struct sortKey) * n);
+    for (int j = 0; j < n; j++)
+    {
+        erow *row = &E.row[from + j];
+        k[j].inexact = 0;
+        k[j].key = flags & SORT_NUMERIC ? editorSortNumber(row, &k[j].inexact) : editorSortText(row, 0);
+        if (flags & SORT_REVERSE)
+            k[j].key = ~k[j].key;
+        k[j].idx = from + j;
+    }
+    if (!(flags & SORT_KEEP))
+    {
+        struct sortKey *tmp = memRealloc(MEM_ROWS, NULL, sizeof(struct sortKey) * n);
+        editorSortKeys(k, tmp, n);
+        if (flags & SORT_NUMERIC)
+            editorSortNumberTies(k, n, flags);
+        else
+            editorSortTies(k, tmp, n, 0, flags);
+        memFree(MEM_ROWS, tmp);
+    }
+
+    // the kept rows go first in their new order, the repeats after them
+    int *order = memRealloc(MEM_ROWS, NULL, sizeof(int) * n);
+    int kept = 0;
+    int drop = n;
+    for (int j = 0; j < n; j++)
+    {
+        erow *a = &E.row[k[j].idx];
+        erow *b = 0 < j ? &E.row[k[j - 1].idx] : NULL;
+        int same = 0 < j && k[j].key == k[j - 1].key &&
+                   (flags & SORT_NUMERIC ? editorSortNumbers(a, b) : editorSortLines(a, b)) == 0;
+        if (flags & SORT_UNIQUE && same)
+            order[--drop] = k[j].idx;
+        else
+            order[kept++] = k[j].idx;
+    }
+    memFree(MEM_ROWS, k);
+
+    erow *moved = memRealloc(MEM_ROWS, NULL, sizeof(erow) * n);
+    for (int j = 0; j < n; j++)
+        moved[j] = E.row[order[j]];
+    memcpy(&E.row[from], moved, sizeof(erow) * n);
+    memFree(MEM_ROWS, moved);
+    if (wrap.enabled && to < wrap.n)
+    {
+        int *height = memRealloc(MEM_WRAP, NULL, sizeof(int) * n);
+        for (int j = 0; j < n; j++)
+            height[j] = wrap.height[order[j]];
+        memcpy(&wrap.height[from], height, sizeof(int) * n);
+        memFree(MEM_WRAP, height);
+        struct wrapBreaks **breaks = memRealloc(MEM_WRAP, NULL, sizeof(struct wrapBreaks *) * n);
+        for (int j = 0; j < n; j++)
+            breaks[j] = wrap.breaks[order[j]];
+        memcpy(&wrap.breaks[from], breaks, sizeof(struct wrapBreaks *) * n);
+        memFree(MEM_WRAP, breaks);
+        wrap.stale = 1;
+    }
+    if (diff.enabled && to < diff.n)
+    {
+        uint64_t *hash = memRealloc(MEM_DIFF, NULL, sizeof(uint64_t) * n);
+        for (int j = 0; j < n; j++)
+            hash[j] = diff.hash[order[j]];
+        memcpy(&diff.hash[from], hash, sizeof(uint64_t) * n);
+        memFree(MEM_DIFF, hash);
+        diff.stale = 1;
+    }
+    memFree(MEM_ROWS, order);
+    for (int j = from; j <= to; j++)
+        E.row[j].idx = j;
+
+    if (kept < n)
+        editorSpliceRows(from + kept, n - kept, NULL, 0);
+    // highlight the range again in its new order without rippling ahead of it
+    int numrows = E.numrows;
+    for (int j = from; j < from + kept; j++)
+    {
+        E.numrows = j + 1;
+        editorUpdateSyntax(&E.row[j]);
+    }
+    E.numrows = numrows;
+    if (from + kept < E.numrows)
+        editorUpdateSyntax(&E.row[from + kept]);
+    E.dirty++;
+    E.cy = from;
+    E.cx = 0;
+    if (kept < n)
+        editorSetStatusMessage("%d lines, %d repeats dropped", n, n - kept);
+    else if (flags & SORT_KEEP)
+        editorSetStatusMessage("No repeats in %d lines", n);
+    else
+        editorSetStatusMessage("%d lines sorted", n);
+}
+
+// a built-in in place of !command: sort with any of n (numeric), r
+// (reverse) and u (unique), or uniq; -1 if cmd is neither
+int editorSortFlags(char *cmd)
+{
+    if (strcmp(cmd, "uniq") == 0)
+        return SORT_UNIQUE | SORT_KEEP;
+    if (strncmp(cmd, "sort", 4) != 0 || cmd[4 + strspn(cmd + 4, " -nru")] != '\0')
+        return -1;
+    return (strchr(cmd + 4, 'n') ? SORT_NUMERIC : 0) |
+           (strchr(cmd + 4, 'r') ? SORT_REVERSE : 0) |
+           (strchr(cmd + 4, 'u') ? SORT_UNIQUE : 0);
+}
+
+/*** filter ***/
+
+// run rows from to to through sh -c cmd and put what it prints in their place;
+// feeding and reading share one poll loop so neither side can fill its pipe
+// and wait on the other, and the output is read straight into an arena chunk
+// the new rows then point into
+void editorFilterRows(int from, int to, char *cmd)
+{
+    int in[2], out[2];
+    if (pipe2(in, O_CLOEXEC) == -1)
+        die("pipe2");
+    if (pipe2(out, O_CLOEXEC) == -1)
+        die("pipe2");
+    char *argv[] = {"/bin/sh", "-c", cmd, NULL};
+    pid_t pid = editorSpawn(argv, in[0], out[1]);
+    close(in[0]);
+    close(out[1]);
+    if (pid == -1)
+    {
+        close(in[1]);
+        close(out[0]);
+        editorSetStatusMessage("Can't run %s: %s", cmd, strerror(errno));
+        return;
+    }
+    fcntl(in[1], F_SETFL, O_NONBLOCK);
+    fcntl(out[0], F_SETFL, O_NONBLOCK);
+    void (*sigpipe)(int) = signal(SIGPIPE, SIG_IGN); // commands may stop reading early
+
+    size_t head = sizeof(char *); // where the arena link goes
+    size_t cap = 64 * 1024, len = 0;
+    char *chunk = malloc(cap);
+    if (chunk == NULL)
+        die("malloc");
+    int row = from, off = 0; // next byte to feed, the newline being off == size
+    int feed = in[1], aborted = 0;
+    while (out[0] != -1)
+    {
+        struct pollfd fds[3] = {{out[0], POLLIN, 0}, {feed, POLLOUT, 0}, {STDIN_FILENO, POLLIN, 0}};
+        if (poll(fds, 3, -1) == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            die("poll");
+        }
+        if (fds[2].revents & POLLIN)
+        {
+            // the command has the editor until it's done, Ctrl-C or ESC stops
+            // it; whatever the shell started is left to die writing to the
+            // closed pipe
+            char c;
+            if (read(STDIN_FILENO, &c, 1) == 1 && (c == CTRL_KEY('c') || c == '\x1b'))
+            {
+                kill(pid, SIGTERM);
+                aborted = 1;
+                close(out[0]);
+                break;
+            }
+        }
+        if (fds[1].revents)
+        {
+            // hand the rows over as they are, a newline after each
+            struct iovec iov[1024];
+            int n = 0;
+            for (int j = row, o = off; j <= to && n + 2 <= (int)(sizeof(iov) / sizeof(iov[0])); j++, o = 0)
+            {
+                erow *r = &E.row[j];
+                if (o < r->size)
+                    iov[n++] = (struct iovec){&r->chars[o], r->size - o};
+                iov[n++] = (struct iovec){"\n", 1};
+            }
+            ssize_t sent = n ? writev(feed, iov, n) : 0;
+            if (sent == -1 && errno != EAGAIN && errno != EINTR)
+                row = to + 1; // the command stopped reading
+            for (; 0 < sent; row++, off = 0)
+            {
+                int left = E.row[row].size + 1 - off;
+                if (sent < left)
+                {
+                    off += sent;
+                    break;
+                }
+                sent -= left;
+            }
+            if (to < row)
+            {
+                close(feed);
+                feed = -1;
+            }
+        }
+        if (fds[0].revents)
+        {
+            if (cap < head + len + 64 * 1024 + 1)
+            {
+                cap *= 2;
+                chunk = realloc(chunk, cap);
+                if (chunk == NULL)
+                    die("realloc");
+            }
+            ssize_t n = read(out[0], chunk + head + len, cap - head - len - 1);
+            if (0 < n)
+                len += n;
+            else if (n == 0 || (errno != EAGAIN && errno != EINTR))
+            {
+                close(out[0]);
+                out[0] = -1;
+            }
+        }
+    }
+    if (feed != -1)
+        close(feed);
+    int status;
+    waitpid(pid, &status, 0);
+    signal(SIGPIPE, sigpipe);
+
+    if (aborted || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+    {
+        free(chunk);
+        if (aborted)
+            editorSetStatusMessage("Filter stopped, lines unchanged");
+        else
+            editorSetStatusMessage("%s failed with status %d, lines unchanged", cmd,
+                                   WIFEXITED(status) ? WEXITSTATUS(status) : -1);
+        return;
+    }
+
+    char *text = NULL;
+    if (len)
+    {
+        chunk = realloc(chunk, head + len + 1); // room for the last row's terminator
+        arenaAdopt(chunk, head + len + 1);
+        text = chunk + head;
+    }
+    else
+    {
+        free(chunk);
+    }
+    int before = E.numrows;
+    editorSpliceRows(from, to - from + 1, text, len);
+    E.cy = from;
+    E.cx = 0;
+    editorSetStatusMessage("%d lines through %s gave %d", to - from + 1, cmd, to - from + 1 + E.numrows - before);
+}
+
+// a line number in a filter range: digits, . for the cursor's or $ for the last
+int editorFilterLine(char **s)
+{
+    if (**s == '.')
+    {
+        (*s)++;
+        return E.cy + 1;
+    }
+    if (**s == '$')
+    {
+        (*s)++;
+        return E.numrows;
+    }
+    return strtol(*s, s, 10);
+}
+
+// vi style: a range, then ! and the command or one of the built-ins sort
+// and uniq; % is every line, a,b the lines from a to b, and no range the
+// cursor's line for a command and every line for a built-in
+void editorFilter()
+{
+    if (editorReadOnly())
+        return;
+    char *input = editorPrompt("Filter: %s (range!command or range sort [nru] or uniq, range %% or a,b with . and $)", NULL);
+    if (input == NULL)
+        return;
+
+    char *s = input;
+    int from = E.cy + 1, to = E.cy + 1;
+    if (*s == '%')
+    {
+        s++;
+        from = 1;
+        to = E.numrows;
+    }
+    else if (isdigit((unsigned char)*s) || *s == '.' || *s == '$')
+    {
+        from = to = editorFilterLine(&s);
+        if (*s == ',')
+        {
+            s++;
+            to = editorFilterLine(&s);
+        }
+    }
+    int flags = *s == '!' ? -1 : editorSortFlags(s);
+    if (s == input && flags != -1)
+    {
+        from = 1;
+        to = E.numrows;
+    }
+    if ((*s != '!' || s[1] == '\0') && flags == -1)
+        editorSetStatusMessage("Filter wants range!command or a built-in, like %%!fmt or %%sort u");
+    else if (from < 1 || to < from || E.numrows < to)
+        editorSetStatusMessage("No lines %d to %d", from, to);
+    else if (flags != -1)
+        editorSortRows(from - 1, to - 1, flags);
+    else
+        editorFilterRows(from - 1, to - 1, s + 1);
+    memFree(MEM_PROMPT, input);
+}
+
+/*** completion ***/
+
+// where the word ending at cx starts
+int editorWordStart(erow *row, int cx)
+{
+    while (0 < cx && editorIsWordChar((unsigned char)row->chars[cx - 1]))
+        cx--;
+    return cx;
+}
+
+// show the best completions of the word being typed, as long as they fit
+void editorCompleteHint()
+{
+    if (view.fd != -1 || hex.map || E.numrows <= E.cy)
+        return; // the viewer has no E.row to look in
+    erow *row = &E.row[E.cy];
+    int start = editorWordStart(row, E.cx);
+    int plen = E.cx - start;
+    if (plen < ZILO_WORD_MIN - 1 || ZILO_WORD_MAX < plen)
+        return;
+
+    char cand[ZILO_COMPLETE_MAX][ZILO_WORD_MAX + 1];
+    int n = editorWordsComplete(&row->chars[start], plen, cand, ZILO_COMPLETE_MAX);
+    if (n == 0)
+        return;
+    char msg[sizeof(E.statusmsg)];
+    int len = snprintf(msg, sizeof(msg), "Ctrl-N:");
+    for (int i = 0; i < n && len + 1 + (int)strlen(cand[i]) < (int)sizeof(msg); i++)
+        len += snprintf(msg + len, sizeof(msg) - len, " %s", cand[i]);
+    editorSetStatusMessage("%s", msg);
+}
+
+// complete the word before the cursor with the most frequent word in the
+// buffer it starts, pressing again swaps in the next one
+void editorComplete()
+{
+    if (editorReadOnly() || E.numrows <= E.cy)
+        return;
+    erow *row = &E.row[E.cy];
+    struct completeState *cs = &complete;
+
+    if (cs->n && cs->cy == E.cy && cs->end == E.cx &&
+        cs->end - cs->start == (int)strlen(cs->cand[cs->pick]) &&
+        memcmp(&row->chars[cs->start], cs->cand[cs->pick], cs->end - cs->start) == 0)
+    {
+        cs->pick = (cs->pick + 1) % cs->n;
+        editorRowDelChar(row, cs->start + cs->plen, E.cx - cs->start - cs->plen);
+        E.cx = cs->start + cs->plen;
+    }
+    else
+    {
+        cs->n = 0;
+        int start = editorWordStart(row, E.cx);
+        if (start == E.cx || ZILO_WORD_MAX < E.cx - start)
+        {
+            editorSetStatusMessage("Nothing to complete");
+            return;
+        }
+        cs->n = editorWordsComplete(&row->chars[start], E.cx - start, cs->cand, ZILO_COMPLETE_MAX);
+        if (cs->n == 0)
+        {
+            editorSetStatusMessage("No completions for %.*s", E.cx - start, &row->chars[start]);
+            return;
+        }
+        cs->pick = 0;
+        cs->cy = E.cy;
+        cs->start = start;
+        cs->plen = E.cx - start;
+    }
+
+    for (char *s = cs->cand[cs->pick] + cs->plen; *s; s++)
+        editorRowInsertChar(row, E.cx++, *s);
+    cs->end = E.cx;
+    editorSetStatusMessage("Completion %d of %d: %s", cs->pick + 1, cs->n, cs->cand[cs->pick]);
+}
+
+/*** outline ***/
+
+const char *outline_kinds[] = {"function", "struct", "enum", "type", "macro"};
+
+// first symbol on row at or below
+int editorOutlineFirst(int at)
+{
+    int lo = 0, hi = outline.n;
+    while (lo < hi)
+    {
+        int mid = lo + (hi - lo) / 2;
+        if (outline.sym[mid].row < at)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+// queue a row whose highlight changed for a rescan; rows the first scan
+// hasn't reached yet will be read then anyway
+void editorOutlineTouch(int at)
+{
+    if (outline.scanned <= at)
+        return;
+    if (outline.nrun)
+    {
+        // highlight changes ripple down row by row, so they land on the last run
+        struct outlineRun *last = &outline.run[outline.nrun - 1];
+        if (last->start <= at && at <= last->end)
+        {
+            if (at == last->end)
+                last->end++;
+            return;
+        }
+    }
+    if (outline.runcap <= outline.nrun)
+    {
+        outline.runcap = outline.runcap ? outline.runcap * 2 : 16;
+        outline.run = memRealloc(MEM_OUTLINE, outline.run, sizeof(struct outlineRun) * outline.runcap);
+    }
+    outline.run[outline.nrun++] = (struct outlineRun){at, at + 1};
+}
+
+// delta rows were inserted at at, or -delta rows deleted from it
+void editorOutlineSplice(int at, int delta)
+{
+    int a = editorOutlineFirst(at);
+    if (delta < 0 && a < outline.n)
+    {
+        int b = editorOutlineFirst(at - delta);
+        memmove(&outline.sym[a], &outline.sym[b], sizeof(struct outlineSym) * (outline.n - b));
+        outline.n -= b - a;
+    }
+    for (int i = a; i < outline.n; i++)
+        outline.sym[i].row += delta;
+
+    // a deleted row past at moves to at, an inserted one shifts what's at or below it
+    int kept = 0;
+    for (int i = 0; i < outline.nrun; i++)
+    {
+        struct outlineRun r = outline.run[i];
+        if (at < r.start || (0 < delta && at == r.start))
+            r.start = at < r.start + delta ? r.start + delta : at;
+        if (at < r.end)
+            r.end = at < r.end + delta ? r.end + delta : at;
+        if (r.start < r.end)
+            outline.run[kept++] = r;
+    }
+    outline.nrun = kept;
+
+    if (at < outline.scanned)
+        outline.scanned = at < outline.scanned + delta ? outline.scanned + delta : at;
+}
+
+// the row's chars with comments and strings blanked, from its highlight
+char *editorOutlineCode(erow *row)
+{
+    if (outline.codecap <= row->size)
+    {
+        outline.codecap = row->size + 1;
+        outline.code = memRealloc(MEM_OUTLINE, outline.code, outline.codecap);
+    }
+    int extra = 0; // render bytes past cx from the tabs before it
+    int stop = 0;
+    int span = 0;
+    int pos = 0; // render offset where span starts
+    for (int j = 0; j < row->size; j++)
+    {
+        for (; stop < row->nts && (int)row->ts[stop].cx < j; stop++)
+            if (!row->ts[stop].mb)
+                extra += row->ts[stop].rx - editorRowStopRx(row, stop) - 1;
+        while (span < row->nhl && pos + (int)row->hl[span].len <= j + extra)
+            pos += row->hl[span++].len;
+        int hl = span < row->nhl ? row->hl[span].hl : HL_NORMAL;
+        int text = (hl == HL_COMMENT || hl == HL_MLCOMMENT || hl == HL_STRING);
+        outline.code[j] = text ? ' ' : row->chars[j];
+    }
+    return outline.code;
+}
+
+// the identifier at i, its length or 0
+int editorOutlineIdent(const char *s, int len, int i)
+{
+    if (len <= i || isdigit((unsigned char)s[i]))
+        return 0;
+    int j = i;
+    while (j < len && editorIsWordChar((unsigned char)s[j]))
+        j++;
+    return j - i;
+}
+
+int editorOutlineIs(const char *s, int len, const char *word)
+{
+    return len == (int)strlen(word) && strncmp(s, word, len) == 0;
+}
+
+// definitions on a line of C: macros, and at column 0 struct, union,
+// class and enum bodies, typedef names and function heads
+int editorOutlineParse(const char *s, int len, struct outlineSym *out)
+{
+    int i = 0;
+    while (i < len && isspace((unsigned char)s[i]))
+        i++;
+    if (i < len && s[i] == '#')
+    {
+        for (i++; i < len && isspace((unsigned char)s[i]); i++)
+            ;
+        if (!editorOutlineIs(&s[i], editorOutlineIdent(s, len, i), "define"))
+            return 0;
+        for (i += 6; i < len && isspace((unsigned char)s[i]); i++)
+            ;
+        int n = editorOutlineIdent(s, len, i);
+        if (n == 0 || 255 < n)
+            return 0;
+        *out = (struct outlineSym){0, i, n, SYM_MACRO};
+        return 1;
+    }
+    if (i != 0 || len == 0)
+        return 0;
+
+    // split the line into identifiers and single punctuation chars
+    int at[32], n[32], nt = 0;
+    while (i < len && nt < 32)
+    {
+        if (isspace((unsigned char)s[i]))
+        {
+            i++;
+            continue;
+        }
+        int k = editorOutlineIdent(s, len, i);
+        at[nt] = i;
+        n[nt++] = k;
+        i += k ? k : 1;
+    }
+#define TOKEN(t, w) ((t) < nt && editorOutlineIs(&s[at[t]], n[t], w))
+#define PUNCT(t, c) ((t) < nt && n[t] == 0 && s[at[t]] == (c))
+
+    int t = TOKEN(0, "typedef");
+    if (TOKEN(t, "struct") || TOKEN(t, "union") || TOKEN(t, "class") || TOKEN(t, "enum"))
+    {
+        if (t + 1 < nt && n[t + 1] && (t + 2 == nt || PUNCT(t + 2, '{') || PUNCT(t + 2, ':')))
+        {
+            *out = (struct outlineSym){0, at[t + 1], n[t + 1], TOKEN(t, "enum") ? SYM_ENUM : SYM_STRUCT};
+            return n[t + 1] < 256;
+        }
+    }
+    if (PUNCT(0, '}') && 1 < nt && n[1] && PUNCT(2, ';'))
+    {
+        *out = (struct outlineSym){0, at[1], n[1], SYM_TYPE};
+        return n[1] < 256;
+    }
+    if (t && PUNCT(nt - 1, ';'))
+    {
+        // the name a typedef ends with, function pointers end in a paren
+        int k = nt - 2;
+        if (k < 1 || n[k] == 0 || 255 < n[k])
+            return 0;
+        *out = (struct outlineSym){0, at[k], n[k], SYM_TYPE};
+        return 1;
+    }
+
+    // a function head: a name right before the first paren, without an
+    // initializer before it or a semicolon closing it as a prototype
+    if (n[0] == 0 || PUNCT(nt - 1, ';'))
+        return 0;
+    for (int k = 1; k < nt; k++)
+    {
+        if (PUNCT(k, '='))
+            return 0;
+        if (!PUNCT(k, '('))
+            continue;
+        if (n[k - 1] == 0 || 255 < n[k - 1] || TOKEN(k - 1, "if") || TOKEN(k - 1, "while") ||
+            TOKEN(k - 1, "for") || TOKEN(k - 1, "switch") || TOKEN(k - 1, "return") || TOKEN(k - 1, "sizeof"))
+            return 0;
+        *out = (struct outlineSym){0, at[k - 1], n[k - 1], SYM_FUNCTION};
+        return 1;
+    }
+    return 0;
+#undef TOKEN
+#undef PUNCT
+}
+
+// replace the symbols of row at with what it defines now
+void editorOutlineScan(int at)
+{
+    if (E.numrows <= at)
+        return;
+    erow *row = &E.row[at];
+    struct outlineSym found;
+    // long rows only keep the highlight of a window, and nobody defines much in them
+    int n = row->lr ? 0 : editorOutlineParse(editorOutlineCode(row), row->size, &found);
+    found.row = at;
+
+    int a = editorOutlineFirst(at);
+    int b = a;
+    while (b < outline.n && outline.sym[b].row == at)
+        b++;
+    if (n != b - a)
+    {
+        if (outline.cap < outline.n + n)
+        {
+            outline.cap = outline.cap ? outline.cap * 2 : 256;
+            outline.sym = memRealloc(MEM_OUTLINE, outline.sym, sizeof(struct outlineSym) * outline.cap);
+        }
+        memmove(&outline.sym[a + n], &outline.sym[b], sizeof(struct outlineSym) * (outline.n - b));
+        outline.n += n - (b - a);
+    }
+    if (n)
+        outline.sym[a] = found;
+}
+
+int editorOutlinePending()
+{
+    return view.fd == -1 && E.syntax && (outline.nrun || outline.scanned < E.numrows);
+}
+
+// scan up to budget rows, touched ones first
+void editorOutlineStep(int budget)
+{
+    while (0 < budget && outline.nrun)
+    {
+        struct outlineRun *r = &outline.run[outline.nrun - 1];
+        editorOutlineScan(r->start++);
+        if (r->start == r->end)
+            outline.nrun--;
+        budget--;
+    }
+    for (; 0 < budget && outline.scanned < E.numrows; budget--)
+        editorOutlineScan(outline.scanned++);
+}
+
+void *editorOutlineWorker(void *arg)
+{
+    (void)arg;
+    pthread_mutex_lock(&outline.lock);
+    while (1)
+    {
+        if (__atomic_load_n(&outline.idle, __ATOMIC_SEQ_CST) && editorOutlinePending())
+        {
+            editorOutlineStep(ZILO_OUTLINE_STEP);
+            // a key may have come in, let the main thread take the lock
+            pthread_mutex_unlock(&outline.lock);
+            pthread_mutex_lock(&outline.lock);
+        }
+        else
+        {
+            pthread_cond_wait(&outline.wake, &outline.lock);
+        }
+    }
+    return NULL;
+}
+
+void editorOutlineStart()
+{
+    // signals stay with the main thread
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    outline.started = pthread_create(&outline.thread, NULL, editorOutlineWorker, NULL) == 0;
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+}
+
+// the main thread hands the rows to the worker while it blocks on input and
+// takes them back, waiting out a step in progress, before touching anything
+void editorOutlineIdle(int idle)
+{
+    if (!outline.started)
+        return;
+    if (idle)
+    {
+        pthread_mutex_lock(&outline.lock);
+        __atomic_store_n(&outline.idle, 1, __ATOMIC_SEQ_CST);
+        if (editorOutlinePending())
+            pthread_cond_signal(&outline.wake);
+        pthread_mutex_unlock(&outline.lock);
+    }
+    else
+    {
+        __atomic_store_n(&outline.idle, 0, __ATOMIC_SEQ_CST);
+        pthread_mutex_lock(&outline.lock);
+        pthread_mutex_unlock(&outline.lock);
+    }
+}
+
+// finish whatever the worker hasn't got to, on the main thread
+void editorOutlineSync()
+{
+    while (editorOutlinePending())
+        editorOutlineStep(INT_MAX);
+}
+
+int editorFuzzyStart(const char *name, int i)
+{
+    return i == 0 || name[i - 1] == '_' || (isupper((unsigned char)name[i]) && islower((unsigned char)name[i - 1]));
+}
+
+// query as a case-insensitive subsequence of name, each char taken at the
+// next word start that has it when starts is set; -1 when it doesn't match
+int editorFuzzyPass(const char *name, int len, const char *query, int starts)
+{
+    int score = 0, run = 0, i = 0;
+    for (int q = 0; query[q]; q++)
+    {
+        int c = tolower((unsigned char)query[q]);
+        int j = i;
+        while (j < len && (tolower((unsigned char)name[j]) != c || (starts && !editorFuzzyStart(name, j))))
+            j++;
+        if (j == len && starts)
+            for (j = i; j < len && tolower((unsigned char)name[j]) != c; j++)
+                ;
+        if (j == len)
+            return -1;
+        run = j == i ? run + 1 : 0;
+        score += 1 + 2 * run + (editorFuzzyStart(name, j) ? 3 : 0);
+        i = j + 1;
+    }
+    return score;
+}
+
+// how well query matches name: runs of chars and the starts of words score
+// more, shorter names win ties, -1 when it doesn't match
+int editorFuzzyScore(const char *name, int len, const char *query)
+{
+    int plain = editorFuzzyPass(name, len, query, 0);
+    if (plain < 0)
+        return -1;
+    int starts = editorFuzzyPass(name, len, query, 1);
+    return (plain < starts ? starts : plain) * 256 - len;
+}
+
+void editorOutlineCallback(char *query, int key)
+{
+    static int pick[ZILO_OUTLINE_PICKS];
+    static int score[ZILO_OUTLINE_PICKS];
+    static int npick = 0;
+    static int matches = 0;
+    static int cur = 0;
+
+    E.match_row = -1;
+
+    if (key == '\r' || key == '\x1b')
+    {
+        npick = 0;
+        cur = 0;
+        return;
+    }
+    else if (key == ARROW_RIGHT || key == ARROW_DOWN)
+    {
+        cur = npick ? (cur + 1) % npick : 0;
+    }
+    else if (key == ARROW_LEFT || key == ARROW_UP)
     {
-        if (ftruncate(fd, len) != -1)
+        cur = npick ? (cur + npick - 1) % npick : 0;
+    }
+    else
+    {
+        // keep the best few in order, earlier rows first among equals
+        npick = 0;
+        matches = 0;
+        cur = 0;
+        for (int i = 0; i < outline.n; i++)
         {
-            if (write(fd, buf, len) == len)
+            struct outlineSym *s = &outline.sym[i];
+            int sc = editorFuzzyScore(&E.row[s->row].chars[s->cx], s->len, query);
+            if (sc < 0)
+                continue;
+            matches++;
+            if (npick == ZILO_OUTLINE_PICKS && sc <= score[npick - 1])
+                continue;
+            int j = npick < ZILO_OUTLINE_PICKS ? npick++ : npick - 1;
+            for (; 0 < j && score[j - 1] < sc; j--)
             {
-                close(fd);
-                free(buf);
-                E.dirty = 0;
-                editorSetStatusMessage("%d bytes written to disk", len);
-                return;
+                pick[j] = pick[j - 1];
+                score[j] = score[j - 1];
             }
+            pick[j] = i;
+            score[j] = sc;
         }
-        close(fd);
     }
-    free(buf);
-    editorSetStatusMessage("Can't save! I/O errir: %s", strerror(errno));
+
+    if (npick == 0)
+    {
+        snprintf(outline.prompt, sizeof(outline.prompt), "Symbol: %%s (no match)");
+        return;
+    }
+    struct outlineSym *s = &outline.sym[pick[cur]];
+    erow *row = &E.row[s->row];
+    E.cy = s->row;
+    E.cx = s->cx;
+    E.rowoff = E.numrows;
+    E.match_row = s->row;
+    E.match_rx = editorRowCxToRx(row, s->cx);
+    E.match_len = editorRowCxToRx(row, s->cx + s->len) - E.match_rx;
+    editorFoldReveal(s->row);
+    snprintf(outline.prompt, sizeof(outline.prompt), "Symbol: %%s (%d of %d, %s)",
+             cur + 1, matches, outline_kinds[s->kind]);
 }
 
-/*** find ***/
+// pick a definition from the outline by fuzzy name, arrows go through the best matches
+void editorOutline()
+{
+    if (view.fd != -1 || E.syntax == NULL)
+    {
+        editorSetStatusMessage("No outline without syntax highlighting or in the viewer");
+        return;
+    }
+    editorOutlineSync();
 
-void editorFindCallback(char *query, int key)
+    int saved_cx = E.cx;
+    int saved_cy = E.cy;
+    int saved_coloff = E.coloff;
+    int saved_rowoff = E.rowoff;
+    int saved_segoff = E.segoff;
+
+    // the callback rewrites the prompt with where the picker is
+    snprintf(outline.prompt, sizeof(outline.prompt), "Symbol: %%s (%d defined)", outline.n);
+    char *query = editorPrompt(outline.prompt, editorOutlineCallback);
+    if (query)
+    {
+        memFree(MEM_SEARCH, query);
+    }
+    else
+    {
+        E.cx = saved_cx;
+        E.cy = saved_cy;
+        E.coloff = saved_coloff;
+        E.rowoff = saved_rowoff;
+        E.segoff = saved_segoff;
+    }
+}
+
+// go to where the word under the cursor is defined, again for the next definition
+void editorOutlineDefinition()
 {
-    static int last_match = -1;
-    static int direction = 1;
+    if (view.fd != -1 || E.syntax == NULL || E.numrows <= E.cy)
+        return;
+    erow *row = &E.row[E.cy];
+    int start = editorWordStart(row, E.cx);
+    int end = E.cx;
+    while (end < row->size && editorIsWordChar((unsigned char)row->chars[end]))
+        end++;
+    if (start == end)
+    {
+        editorSetStatusMessage("No word under the cursor");
+        return;
+    }
+    editorOutlineSync();
+
+    int first = editorOutlineFirst(E.cy);
+    while (first < outline.n && outline.sym[first].row == E.cy && outline.sym[first].cx <= start)
+        first++;
+    for (int i = 0; i < outline.n; i++)
+    {
+        struct outlineSym *s = &outline.sym[(first + i) % outline.n];
+        if (s->len != end - start || memcmp(&E.row[s->row].chars[s->cx], &row->chars[start], s->len) != 0)
+            continue;
+        E.cy = s->row;
+        E.cx = s->cx;
+        E.rowoff = E.numrows;
+        editorFoldReveal(s->row);
+        editorSetStatusMessage("%s %.*s at line %d", outline_kinds[s->kind], s->len, &E.row[s->row].chars[s->cx], s->row + 1);
+        return;
+    }
+    editorSetStatusMessage("No definition of %.*s", end - start, &row->chars[start]);
+}
 
-    static int saved_hl_line;
-    static char *saved_hl = NULL;
+/*** grep ***/
 
-    if (saved_hl)
+// Ctrl-A searches every file under the working directory for a literal
+// pattern. Workers walk the tree and search at once, small files through
+// one read and the rest mapped, skipping hidden entries, symlinks and
+// files with a NUL near the start. Hits reach the list as each file is done;
+// workers allocate with plain malloc since the accounting isn't theirs to
+// touch.
+
+// a directory's entries or a file's hits onto the shared lists
+void editorGrepPush(char **paths, int n)
+{
+    pthread_mutex_lock(&grep.lock);
+    if (grep.todocap < grep.ntodo + n)
     {
-        memcpy(E.row[saved_hl_line].hl, saved_hl, E.row[saved_hl_line].rsize);
-        free(saved_hl);
-        saved_hl = NULL;
+        while (grep.todocap < grep.ntodo + n)
+            grep.todocap = grep.todocap ? grep.todocap * 2 : 256;
+        grep.todo = realloc(grep.todo, sizeof(char *) * grep.todocap);
+        if (grep.todo == NULL)
+            die("realloc");
     }
+    memcpy(&grep.todo[grep.ntodo], paths, sizeof(char *) * n);
+    grep.ntodo += n;
+    pthread_cond_broadcast(&grep.work);
+    pthread_mutex_unlock(&grep.lock);
+}
 
-    if (key == '\r' || key == '\x1b')
+// with the lock held: have the main thread look once it gets to it
+void editorGrepWake()
+{
+    if (grep.woken)
+        return;
+    grep.woken = 1;
+    write(grep.wake[1], "", 1);
+}
+
+void editorGrepDir(char *dir)
+{
+    DIR *d = opendir(dir);
+    if (d == NULL)
+        return;
+    char **paths = NULL;
+    int n = 0, cap = 0;
+    struct dirent *de;
+    while ((de = readdir(d)) != NULL)
     {
-        last_match = -1;
-        direction = 1;
+        if (de->d_name[0] == '.')
+            continue; // hidden, along with . and ..
+        int type = de->d_type;
+        char *path;
+        if (strcmp(dir, ".") == 0)
+            path = strdup(de->d_name);
+        else if (asprintf(&path, "%s/%s", dir, de->d_name) == -1)
+            path = NULL;
+        if (path == NULL)
+            die("strdup");
+        if (type == DT_UNKNOWN)
+        {
+            struct stat st;
+            type = lstat(path, &st) == -1 ? DT_UNKNOWN : S_ISDIR(st.st_mode) ? DT_DIR : S_ISREG(st.st_mode) ? DT_REG : DT_UNKNOWN;
+        }
+        if (type != DT_DIR && type != DT_REG)
+        {
+            free(path);
+            continue;
+        }
+        if (cap <= n)
+        {
+            cap = cap ? cap * 2 : 64;
+            paths = realloc(paths, sizeof(char *) * cap);
+            if (paths == NULL)
+                die("realloc");
+        }
+        paths[n++] = path;
+    }
+    closedir(d);
+    if (n)
+        editorGrepPush(paths, n);
+    free(paths);
+}
+
+void editorGrepFile(char *path, char *buf)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd == -1)
+        return;
+    if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode) || st.st_size == 0)
+    {
+        close(fd);
         return;
     }
-    else if (key == ARROW_RIGHT || key == ARROW_DOWN)
+    size_t size = st.st_size;
+    char *map = NULL, *s = buf;
+    if (size <= ZILO_GREP_SMALL)
     {
-        direction = 1;
+        ssize_t n = pread(fd, buf, size, 0);
+        size = n < 0 ? 0 : n;
     }
-    else if (key == ARROW_LEFT || key == ARROW_UP)
+    else
     {
-        direction = -1;
+        map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED)
+            size = 0, map = NULL;
+        else
+            madvise(map, size, MADV_SEQUENTIAL);
+        s = map;
+    }
+    close(fd);
+
+    struct grepHit *hits = NULL;
+    int n = 0, cap = 0;
+    if (size && memchr(s, '\0', size < ZILO_BINARY_PROBE ? size : ZILO_BINARY_PROBE) != NULL)
+        size = 0; // binary, not searched or counted
+    if (size)
+    {
+        char *end = s + size, *counted = s; // lines before counted are in line
+        int line = 1;
+        for (char *p = s; p < end && (p = memmem(p, end - p, grep.pattern, grep.plen)) != NULL;)
+        {
+            for (char *nl; (nl = memchr(counted, '\n', p - counted)) != NULL; counted = nl + 1)
+                line++;
+            char *bol = counted;
+            char *eol = memchr(p, '\n', end - p);
+            if (eol == NULL)
+                eol = end;
+            if (cap <= n)
+            {
+                cap = cap ? cap * 2 : 16;
+                hits = realloc(hits, sizeof(struct grepHit) * cap);
+                if (hits == NULL)
+                    die("realloc");
+            }
+            int len = eol - bol < ZILO_GREP_TEXT ? eol - bol : ZILO_GREP_TEXT;
+            char *text = malloc(len + 1);
+            if (text == NULL)
+                die("malloc");
+            for (int i = 0; i < len; i++)
+                text[i] = iscntrl((unsigned char)bol[i]) ? ' ' : bol[i];
+            text[len] = '\0';
+            hits[n++] = (struct grepHit){0, line, p - bol, text};
+            p = eol; // one hit per line
+        }
+    }
+    if (map)
+        munmap(map, st.st_size);
+
+    pthread_mutex_lock(&grep.lock);
+    grep.searched++;
+    grep.bytes += size;
+    if (n && grep.nhit < ZILO_GREP_HITS)
+    {
+        if (grep.filecap <= grep.nfile)
+        {
+            grep.filecap = grep.filecap ? grep.filecap * 2 : 64;
+            grep.file = realloc(grep.file, sizeof(char *) * grep.filecap);
+        }
+        if (ZILO_GREP_HITS < grep.nhit + n)
+        {
+            for (int i = ZILO_GREP_HITS - grep.nhit; i < n; i++)
+                free(hits[i].text);
+            n = ZILO_GREP_HITS - grep.nhit;
+            grep.stop = 1; // enough to look through
+        }
+        while (grep.hitcap < grep.nhit + n)
+            grep.hitcap = grep.hitcap ? grep.hitcap * 2 : 256;
+        grep.hit = realloc(grep.hit, sizeof(struct grepHit) * grep.hitcap);
+        if (grep.file == NULL || grep.hit == NULL)
+            die("realloc");
+        grep.file[grep.nfile] = strdup(path);
+        for (int i = 0; i < n; i++)
+        {
+            hits[i].file = grep.nfile;
+            grep.hit[grep.nhit++] = hits[i];
+        }
+        grep.nfile++;
+        editorGrepWake();
     }
     else
     {
-        last_match = -1;
-        direction = 1;
+        for (int i = 0; i < n; i++)
+            free(hits[i].text);
     }
+    pthread_mutex_unlock(&grep.lock);
+    free(hits);
+}
 
-    if (last_match == -1)
-        direction = 1;
-    int current = last_match;
-    int i;
-    for (i = 0; i < E.numrows; i++)
+// the next path to look at, NULL once there are none and nobody can add any
+char *editorGrepTake()
+{
+    pthread_mutex_lock(&grep.lock);
+    while (grep.ntodo == 0 && grep.busy && !grep.stop)
+        pthread_cond_wait(&grep.work, &grep.lock);
+    char *path = NULL;
+    if (grep.ntodo && !grep.stop)
     {
-        current += direction;
-        if (current == -1)
-            current = E.numrows - 1;
-        else if (current == E.numrows)
-            current = 0;
+        path = grep.todo[--grep.ntodo];
+        grep.busy++;
+    }
+    else
+    {
+        pthread_cond_broadcast(&grep.work); // the others are done too
+        editorGrepWake();
+    }
+    pthread_mutex_unlock(&grep.lock);
+    return path;
+}
 
-        erow *row = &E.row[current];
-        char *match = strstr(row->render, query);
-        if (match)
+void *editorGrepWorker(void *arg)
+{
+    (void)arg;
+    char *buf = malloc(ZILO_GREP_SMALL);
+    if (buf == NULL)
+        die("malloc");
+    char *path;
+    while ((path = editorGrepTake()) != NULL)
+    {
+        struct stat st;
+        if (lstat(path, &st) == 0 && S_ISDIR(st.st_mode))
+            editorGrepDir(path);
+        else
+            editorGrepFile(path, buf);
+        free(path);
+        pthread_mutex_lock(&grep.lock);
+        grep.busy--;
+        if (grep.busy == 0 && grep.ntodo == 0)
+            pthread_cond_broadcast(&grep.work);
+        pthread_mutex_unlock(&grep.lock);
+    }
+    free(buf);
+    return NULL;
+}
+
+// whether the workers are still going, with the lock held
+int editorGrepRunning()
+{
+    return !grep.stop && (grep.busy || grep.ntodo);
+}
+
+void editorGrepStart(char *pattern)
+{
+    grep.pattern = pattern;
+    grep.plen = strlen(pattern);
+    grep.stop = 0;
+    grep.searched = grep.bytes = 0;
+    grep.sel = grep.top = 0;
+    grep.start = editorNow();
+    if (grep.wake[0] == -1 && pipe2(grep.wake, O_CLOEXEC | O_NONBLOCK) == -1)
+        die("pipe2");
+    char *root = strdup(".");
+    editorGrepPush(&root, 1);
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int want = cpus < 2 ? 2 : ZILO_GREP_THREADS < cpus ? ZILO_GREP_THREADS : cpus; // two overlap i/o even on one cpu
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    for (grep.nthread = 0; grep.nthread < want; grep.nthread++)
+        if (pthread_create(&grep.thread[grep.nthread], NULL, editorGrepWorker, NULL) != 0)
+            break;
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (grep.nthread == 0)
+        die("pthread_create");
+}
+
+// called the workers off and let go of the hits
+void editorGrepStop()
+{
+    pthread_mutex_lock(&grep.lock);
+    grep.stop = 1;
+    pthread_cond_broadcast(&grep.work);
+    pthread_mutex_unlock(&grep.lock);
+    for (int i = 0; i < grep.nthread; i++)
+        pthread_join(grep.thread[i], NULL);
+    grep.nthread = 0;
+
+    for (int i = 0; i < grep.ntodo; i++)
+        free(grep.todo[i]);
+    for (int i = 0; i < grep.nhit; i++)
+        free(grep.hit[i].text);
+    for (int i = 0; i < grep.nfile; i++)
+        free(grep.file[i]);
+    grep.ntodo = grep.nhit = grep.nfile = 0;
+    grep.busy = 0;
+    memFree(MEM_PROMPT, grep.pattern);
+    grep.pattern = NULL;
+    char buf[64];
+    while (0 < read(grep.wake[0], buf, sizeof(buf)))
+        ;
+    grep.woken = 0;
+}
+
+// take the workers' news, returns 1 when the list needs drawing again
+int editorGrepCheck()
+{
+    if (grep.wake[0] == -1 || grep.pattern == NULL)
+        return 0;
+    char buf[64];
+    while (0 < read(grep.wake[0], buf, sizeof(buf)))
+        ;
+    pthread_mutex_lock(&grep.lock);
+    grep.woken = 0;
+    int nhit = grep.nhit, nfile = grep.nfile, running = editorGrepRunning();
+    long searched = grep.searched;
+    double mb = grep.bytes / 1048576.0;
+    pthread_mutex_unlock(&grep.lock);
+    if (running)
+        editorSetStatusMessage("%s: %d hits in %d files, searching %ld files so far", grep.pattern, nhit, nfile,
+                               searched);
+    else
+        editorSetStatusMessage("%s: %d hits in %d of %ld files%s, %.0f MB in %.0f ms | Enter = open, ESC = close",
+                               grep.pattern, nhit, nfile, searched, nhit == ZILO_GREP_HITS ? " (stopped)" : "",
+                               mb, editorNow() - grep.start);
+    return 1;
+}
+
+// open hit i, in place when it is in the file being edited
+void editorGrepOpen(int i)
+{
+    pthread_mutex_lock(&grep.lock);
+    struct grepHit h = grep.hit[i];
+    char *path = strdup(grep.file[h.file]);
+    pthread_mutex_unlock(&grep.lock);
+
+    char *want = realpath(path, NULL), *have = E.filename ? realpath(E.filename, NULL) : NULL;
+    int same = want && have && strcmp(want, have) == 0;
+    free(want);
+    free(have);
+    if (!same)
+    {
+        if (E.dirty || view.fd != -1 || follow.fd != -1 || server.fd != -1)
         {
-            last_match = current;
-            E.cy = current;
-            E.cx = editorRowRxToCx(row, match - row->render);
-            E.rowoff = E.numrows;
+            editorSetStatusMessage("Save or close %s before opening %s", E.filename ? E.filename : "the buffer", path);
+            free(path);
+            return;
+        }
+        if (access(path, R_OK) == -1)
+        {
+            editorSetStatusMessage("Can't open %s: %s", path, strerror(errno));
+            free(path);
+            return;
+        }
+        editorOpen(path);
+    }
+    free(path);
+    if (E.numrows == 0)
+        return;
+    E.cy = h.line - 1 < E.numrows ? h.line - 1 : E.numrows - 1;
+    erow *row = &E.row[E.cy];
+    E.cx = h.cx < row->size ? h.cx : row->size;
+    E.rowoff = E.numrows;
+    editorFoldReveal(E.cy);
+    if (E.cx + grep.plen <= row->size)
+    {
+        E.match_row = E.cy;
+        E.match_rx = editorRowCxToRx(row, E.cx);
+        E.match_len = editorRowCxToRx(row, E.cx + grep.plen) - E.match_rx;
+    }
+    editorSetStatusMessage("%s: line %d", E.filename, h.line);
+}
 
-            saved_hl_line = current;
-            saved_hl = malloc(row->rsize);
-            memcpy(saved_hl, row->hl, row->rsize);
-            memset(&row->hl[match - row->render], HL_MATCH, strlen(query));
+// search the files under the working directory, the hits listed as they come
+void editorGrep()
+{
+    char *pattern = editorPrompt("Grep: %s (literal, under the working directory)", NULL);
+    if (pattern == NULL)
+        return;
+    editorGrepStart(pattern);
+    editorSetStatusMessage("%s: searching", pattern);
+    grep.listing = 1;
+    int open = -1;
+    while (open == -1)
+    {
+        editorRefreshScreen();
+        int c = editorReadKey();
+        pthread_mutex_lock(&grep.lock);
+        int n = grep.nhit;
+        pthread_mutex_unlock(&grep.lock);
+        if (c == '\x1b' || c == CTRL_KEY('q') || c == CTRL_KEY('a'))
             break;
+        else if (c == '\r' && n)
+            open = grep.sel;
+        else if (c == ARROW_UP)
+            grep.sel--;
+        else if (c == ARROW_DOWN)
+            grep.sel++;
+        else if (c == PAGE_UP)
+            grep.sel -= E.screenrows;
+        else if (c == PAGE_DOWN)
+            grep.sel += E.screenrows;
+        else if (c == HOME_KEY)
+            grep.sel = 0;
+        else if (c == END_KEY)
+            grep.sel = n - 1;
+        if (n <= grep.sel)
+            grep.sel = n - 1;
+        if (grep.sel < 0)
+            grep.sel = 0;
+    }
+    grep.listing = 0;
+    if (open != -1)
+        editorGrepOpen(open);
+    else
+        editorSetStatusMessage("");
+    editorGrepStop();
+}
+
+/*** append buffer ***/
+
+struct abuf
+{
+    char *b;
+    int len;
+};
+
+#define ABUF_INIT \
+    {             \
+        NULL, 0   \
+    }
+
+void abAppend(struct abuf *ab, const char *s, int len)
+{
+    char *new = realloc(ab->b, ab->len + len);
+
+    if (new == NULL)
+        return;
+    memcpy(&new[ab->len], s, len);
+    ab->b = new;
+    ab->len += len;
+}
+
+void abFree(struct abuf *ab)
+{
+    free(ab->b);
+}
+
+/*** server ***/
+
+// the socket for a file, one per real path under a directory only the user can enter
+char *editorServerPath(char *filename)
+{
+    char dir[64];
+    snprintf(dir, sizeof(dir), "/tmp/zilo-%d", (int)getuid());
+    struct stat st;
+    if (mkdir(dir, 0700) == -1 && errno != EEXIST)
+        die("mkdir");
+    if (lstat(dir, &st) == -1 || !S_ISDIR(st.st_mode) || st.st_uid != getuid() || (st.st_mode & 077))
+    {
+        errno = EACCES;
+        die(dir);
+    }
+
+    char *real = realpath(filename, NULL);
+    const char *name = real ? real : filename;
+    char *path = malloc(sizeof(dir) + 32);
+    snprintf(path, sizeof(dir) + 32, "%s/%016llx.sock", dir,
+             (unsigned long long)fnv1a(14695981039346656037ull, name, strlen(name)));
+    free(real);
+    return path;
+}
+
+int editorServerConnect(char *path)
+{
+    struct sockaddr_un addr = {0};
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd == -1)
+        die("socket");
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+void editorServerExit()
+{
+    if (server.fd != -1)
+        unlink(server.path);
+}
+
+// hand the screen back: the client sees a clear screen and hangs up, reads
+// then hit the end of /dev/null and editorServerAccept waits for another
+void editorServerDetach()
+{
+    editorDrainOutput();
+    write(STDOUT_FILENO, "\x1b[2J\x1b[H", 7);
+    int null = open("/dev/null", O_RDWR);
+    dup2(null, STDIN_FILENO);
+    dup2(null, STDOUT_FILENO);
+    close(null);
+    server.attached = 0;
+}
+
+// wait for a client and give it the screen; the hello it sends first is
+// "zilo <rows> <cols>", or "zilo stop" to shut the server down
+void editorServerAccept()
+{
+    if (server.attached)
+        editorServerDetach();
+    server.lost = 0;
+    while (1)
+    {
+        editorOutlineIdle(1);
+        int fd = accept(server.fd, NULL, NULL);
+        editorOutlineIdle(0);
+        if (fd == -1)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            die("accept");
+        }
+
+        // a client that never says hello doesn't get to hold the server
+        struct timeval tv = {1, 0};
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        char hello[64];
+        int len = 0;
+        while (len < (int)sizeof(hello) - 1 && read(fd, &hello[len], 1) == 1 && hello[len] != '\n')
+            len++;
+        hello[len] = '\0';
+        tv.tv_sec = 0;
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+        int rows, cols;
+        if (strcmp(hello, "zilo stop") == 0)
+        {
+            if (!E.dirty)
+                exit(0);
+            dprintf(fd, "%s has unsaved changes, attach and save it first\n", E.filename);
+        }
+        else if (sscanf(hello, "zilo %d %d", &rows, &cols) == 2 && 3 <= rows && 1 <= cols)
+        {
+            dup2(fd, STDIN_FILENO);
+            dup2(fd, STDOUT_FILENO);
+            close(fd);
+            server.attached = 1;
+            server.full = 1;
+            E.screenrows = rows - 2;
+            E.screencols = cols - (diff.enabled ? ZILO_DIFF_GUTTER : 0);
+            enableNonblockingOutput();
+            editorSetStatusMessage("Attached to %s | Ctrl-Q = detach, the file stays loaded", E.filename);
+            editorRefreshScreen();
+            return;
         }
+        close(fd);
     }
 }
 
-void editorFind()
+// keep only the lines of a composed frame that differ from what the client
+// has; each line resets its colors at the end, so any of them can be skipped
+void editorServerDiff(struct abuf *ab)
 {
-    int saved_cx = E.cx;
-    int saved_cy = E.cy;
-    int saved_coloff = E.coloff;
-    int saved_rowoff = E.rowoff;
+    int lines = E.screenrows + 2 + perf.overlay;
+    if (server.nline != lines)
+    {
+        server.line = realloc(server.line, sizeof(uint64_t) * lines);
+        server.nline = lines;
+        server.full = 1;
+    }
 
-    char *query = editorPrompt("Search: %s (Use ESC/Arrows/Enter)", editorFindCallback);
-    if (query)
+    // the frame hides the cursor and homes it, then has a line per screen
+    // row split by \r\n, then the cursor move and the cursor shown again
+    char *p = ab->b + 9;
+    char *end = ab->b + ab->len - 7;
+    while (p < end && memcmp(end, "\x1b[", 2) != 0)
+        end--;
+
+    struct abuf out = ABUF_INIT;
+    abAppend(&out, "\x1b[?25l", 6);
+    for (int y = 0; y < lines && p <= end; y++)
+    {
+        char *eol = memmem(p, end - p, "\r\n", 2);
+        char *next = eol ? eol + 2 : end;
+        if (eol == NULL)
+            eol = end;
+        uint64_t h = fnv1a(14695981039346656037ull, p, eol - p);
+        if (server.full || h != server.line[y])
+        {
+            char buf[32];
+            int len = snprintf(buf, sizeof(buf), "\x1b[%d;1H", y + 1);
+            abAppend(&out, buf, len);
+            abAppend(&out, p, eol - p);
+            server.line[y] = h;
+        }
+        p = next;
+    }
+    abAppend(&out, end, ab->b + ab->len - end);
+    server.full = 0;
+
+    abFree(ab);
+    *ab = out;
+}
+
+// load filename and serve it on path until told to stop; the socket is
+// bound before the load so clients queue up instead of starting servers
+void editorServe(char *filename, char *path)
+{
+    struct sockaddr_un addr = {0};
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+    server.fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (server.fd == -1)
+        die("socket");
+    if (bind(server.fd, (struct sockaddr *)&addr, sizeof(addr)) == -1)
     {
-        free(query);
+        if (errno != EADDRINUSE)
+            die("bind");
+        if (editorServerConnect(path) != -1)
+            exit(0); // someone else serves it already
+        unlink(path); // left behind by a server that died
+        if (bind(server.fd, (struct sockaddr *)&addr, sizeof(addr)) == -1)
+            die("bind");
     }
-    else
+    if (listen(server.fd, 8) == -1)
+        die("listen");
+    server.path = path;
+    atexit(editorServerExit);
+    signal(SIGPIPE, SIG_IGN); // clients may vanish mid-frame
+
+    int null = open("/dev/null", O_RDWR);
+    dup2(null, STDIN_FILENO);
+    dup2(null, STDOUT_FILENO);
+    close(null);
+
+    initEditorSize(22, 80);
+    editorOpen(filename);
+    editorOutlineStart();
+    while (1)
     {
-        E.cx = saved_cx;
-        E.cy = saved_cy;
-        E.coloff = saved_coloff;
-        E.rowoff = saved_rowoff;
+        editorRefreshScreen();
+        editorProcessKeypress();
     }
 }
 
-/*** append buffer ***/
-
-struct abuf
+// the thin client: attach the terminal to filename's server, starting one
+// in the background first when there is none, and relay bytes both ways
+void editorClient(char *filename)
 {
-    char *b;
-    int len;
-};
-
-#define ABUF_INIT \
-    {             \
-        NULL, 0   \
+    char *path = editorServerPath(filename);
+    int fd = editorServerConnect(path);
+    if (fd == -1)
+    {
+        pid_t pid = fork();
+        if (pid == -1)
+            die("fork");
+        if (pid == 0)
+        {
+            // twice, so the server is nobody's child once this one exits
+            setsid();
+            if (fork() == 0)
+            {
+                int null = open("/dev/null", O_RDWR);
+                dup2(null, STDERR_FILENO);
+                close(null);
+                editorServe(filename, path);
+            }
+            _exit(0);
+        }
+        waitpid(pid, NULL, 0);
+        for (int tries = 0; fd == -1 && tries < 500; tries++)
+        {
+            usleep(10000);
+            fd = editorServerConnect(path);
+        }
+        if (fd == -1)
+            die("connect");
     }
+    free(path);
 
-void abAppend(struct abuf *ab, const char *s, int len)
-{
-    char *new = realloc(ab->b, ab->len + len);
+    signal(SIGPIPE, SIG_IGN); // a server gone mid-write shows up as the read below ending
+    enableRawMode();
+    int rows, cols;
+    if (getWindowSize(&rows, &cols) == -1)
+        die("getWindowSize");
+    dprintf(fd, "zilo %d %d\n", rows, cols);
 
-    if (new == NULL)
-        return;
-    memcpy(&new[ab->len], s, len);
-    ab->b = new;
-    ab->len += len;
+    char buf[64 * 1024];
+    while (1)
+    {
+        struct pollfd fds[2] = {{STDIN_FILENO, POLLIN, 0}, {fd, POLLIN, 0}};
+        if (poll(fds, 2, -1) == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            die("poll");
+        }
+        if (fds[0].revents)
+        {
+            ssize_t n = read(STDIN_FILENO, buf, sizeof(buf));
+            if (0 < n)
+                editorWriteAll(fd, buf, n);
+        }
+        if (fds[1].revents)
+        {
+            ssize_t n = read(fd, buf, sizeof(buf));
+            if (n <= 0)
+                exit(0); // detached, or the server is gone
+            editorWriteAll(STDOUT_FILENO, buf, n);
+        }
+    }
 }
 
-void abFree(struct abuf *ab)
+// ask filename's server to shut down, it refuses while the file is modified
+int editorServerStop(char *filename)
 {
-    free(ab->b);
+    char *path = editorServerPath(filename);
+    int fd = editorServerConnect(path);
+    free(path);
+    if (fd == -1)
+    {
+        fprintf(stderr, "no server for %s\n", filename);
+        return 1;
+    }
+    dprintf(fd, "zilo stop\n");
+    char buf[256];
+    ssize_t n, got = 0;
+    while ((n = read(fd, buf, sizeof(buf))) > 0)
+    {
+        fwrite(buf, 1, n, stderr);
+        got += n;
+    }
+    close(fd);
+    return got != 0;
 }
 
 /*** output ***/
@@ -932,16 +7614,33 @@ void editorScroll()
     E.rx = 0;
     if (E.cy < E.numrows)
     {
-        E.rx = editorRowCxToRx(&E.row[E.cy], E.cx);
+        E.rx = editorRowCxToRx(editorRow(E.cy), E.cx);
+    }
+    if (wrap.enabled)
+    {
+        editorFoldReveal(E.cy);
+        editorWrapScroll();
+        return;
     }
 
-    if (E.cy < E.rowoff)
+    if (fold.n)
     {
-        E.rowoff = E.cy;
+        // compare screen rows, with the cursor's row out of any fold
+        editorFoldReveal(E.cy);
+        int cy = editorFoldVisible(E.cy);
+        int rowoff = editorFoldVisible(E.rowoff);
+        if (cy < rowoff)
+            rowoff = cy;
+        if (rowoff + E.screenrows <= cy)
+            rowoff = cy - E.screenrows + 1;
+        E.rowoff = editorFoldRow(rowoff);
     }
-    if (E.rowoff + E.screenrows <= E.cy)
+    else
     {
-        E.rowoff = E.cy - E.screenrows + 1;
+        if (E.cy < E.rowoff)
+            E.rowoff = E.cy;
+        if (E.rowoff + E.screenrows <= E.cy)
+            E.rowoff = E.cy - E.screenrows + 1;
     }
 
     if (E.rx < E.coloff)
@@ -954,12 +7653,159 @@ void editorScroll()
     }
 }
 
+// draw the screencols columns of row starting at render column coloff,
+// returns how many of them it filled
+int editorDrawRow(struct abuf *ab, erow *row, int filerow, int coloff)
+{
+    editorLongFocus(row, coloff);
+    char *c = row->render;
+    int col = row->lr ? row->lr->roff : 0; // render column of c[b]
+    int b = 0;
+
+    // skip to the first visible char, which ASCII rows can index directly
+    if (row->nmb == 0)
+    {
+        b = coloff - col;
+        if (row->rsize < b)
+            b = row->rsize;
+        col += b;
+    }
+    else
+    {
+        while (b < row->rsize)
+        {
+            unsigned int cp;
+            int n = utf8Decode(&c[b], row->rsize - b, &cp);
+            int w = unicodeWidth(cp);
+            if (coloff < col + w)
+                break;
+            col += w;
+            b += n;
+        }
+    }
+
+    // find the highlight span covering it
+    int span = 0;
+    int spanleft = 0;
+    int pos = 0;
+    while (span < row->nhl && pos + (int)row->hl[span].len <= b)
+        pos += row->hl[span++].len;
+    if (span < row->nhl)
+        spanleft = pos + row->hl[span].len - b;
+
+    int current_color = -1;
+    int end = coloff + E.screencols;
+    while (b < row->rsize && col < end)
+    {
+        unsigned int cp = (unsigned char)c[b];
+        int n = 1;
+        int w = 1;
+        if (0x80 <= cp)
+        {
+            n = utf8Decode(&c[b], row->rsize - b, &cp);
+            w = unicodeWidth(cp);
+        }
+        if (end < col + w)
+            break; // a wide char that doesn't fit
+
+        unsigned char hl = (span < row->nhl) ? row->hl[span].hl : HL_NORMAL;
+        if (span < row->nhl)
+        {
+            spanleft -= n;
+            while (spanleft <= 0 && ++span < row->nhl)
+                spanleft += row->hl[span].len;
+        }
+        if (filerow == E.match_row && E.match_rx <= col &&
+            col < E.match_rx + E.match_len)
+            hl = HL_MATCH;
+        if ((filerow == bracket.mark_row[0] && col == bracket.mark_rx[0]) ||
+            (filerow == bracket.mark_row[1] && col == bracket.mark_rx[1]))
+            hl = HL_MATCH;
+
+        if (col < coloff)
+        {
+            // a wide char cut by the left edge
+            for (int k = coloff; k < col + w; k++)
+                abAppend(ab, " ", 1);
+        }
+        else if (cp < 0x20 || cp == 0x7f || (0x80 <= cp && cp < 0xa0) || cp == UTF8_INVALID)
+        {
+            char sym = (cp <= 26) ? '@' + cp : '?';
+            abAppend(ab, "\x1b[7m", 4);
+            abAppend(ab, &sym, 1);
+            abAppend(ab, "\x1b[m", 3);
+            if (current_color != -1)
+            {
+                char buf[16];
+                int clen = snprintf(buf, sizeof(buf), "\x1b[%dm", current_color);
+                abAppend(ab, buf, clen);
+            }
+        }
+        else if (hl == HL_NORMAL)
+        {
+            if (current_color != -1)
+            {
+                abAppend(ab, "\x1b[39m", 5);
+                current_color = -1;
+            }
+            abAppend(ab, &c[b], n);
+        }
+        else
+        {
+            int color = editorSyntaxToColor(hl);
+            if (color != current_color)
+            {
+                current_color = color;
+                char buf[16];
+                int clen = snprintf(buf, sizeof(buf), "\x1b[%dm", color);
+                abAppend(ab, buf, clen);
+            }
+            abAppend(ab, &c[b], n);
+        }
+        col += w;
+        b += n;
+    }
+    abAppend(ab, "\x1b[39m", 5);
+    return col < coloff ? 0 : col - coloff;
+}
+
+// the marker after a fold's first row, within the cols left on the line
+void editorDrawFold(struct abuf *ab, int filerow, int cols)
+{
+    int i = editorFoldAt(filerow);
+    if (i < 0 || fold.r[i].start != filerow)
+        return;
+    char buf[32];
+    int len = snprintf(buf, sizeof(buf), " +%d lines ", fold.r[i].end - filerow);
+    if (cols < len)
+        len = cols;
+    if (len <= 0)
+        return;
+    abAppend(ab, "\x1b[7m", 4);
+    abAppend(ab, buf, len);
+    abAppend(ab, "\x1b[m", 3);
+}
+
+// the diff view's marker left of a screen line, ' ' for none
+void editorDrawGutter(struct abuf *ab, char mark)
+{
+    char buf[32];
+    int len = snprintf(buf, sizeof(buf), "%*s", ZILO_DIFF_GUTTER, "");
+    if (mark != ' ')
+        len = snprintf(buf, sizeof(buf), "\x1b[%dm%c\x1b[39m%*s", mark == '+' ? 32 : mark == '~' ? 33 : 31,
+                       mark, ZILO_DIFF_GUTTER - 1, "");
+    abAppend(ab, buf, len);
+}
+
 void editorDrawRows(struct abuf *ab)
 {
     int y;
+    int filerow = E.rowoff;
+    int seg = E.segoff; // screen line within filerow when wrapping
     for (y = 0; y < E.screenrows; y++)
     {
-        int filerow = y + E.rowoff;
+        if (diff.enabled)
+            editorDrawGutter(ab, filerow < E.numrows && seg == 0 ? editorDiffMark(filerow) : ' ');
         if (E.numrows <= filerow)
         {
             if (E.numrows == 0 && y == E.screenrows / 3)
@@ -985,79 +7831,166 @@ void editorDrawRows(struct abuf *ab)
                 abAppend(ab, "~", 1);
             }
         }
-        else
+        else if (wrap.enabled)
         {
-            int len = E.row[filerow].rsize - E.coloff;
-            if (len < 0)
-                len = 0;
-            if (E.screencols < len)
-                len = E.screencols;
-
-            char *c = &E.row[filerow].render[E.coloff];
-            unsigned char *hl = &E.row[filerow].hl[E.coloff];
-            int current_color = -1;
-            int j;
-            for (j = 0; j < len; j++)
+            int cols = editorDrawRow(ab, &E.row[filerow], filerow, editorWrapStart(filerow, seg));
+            if (++seg == wrap.height[filerow])
             {
-                if (iscntrl(c[j]))
-                {
-                    char sym = (c[j] <= 26) ? '@' + c[j] : '?';
-                    abAppend(ab, "\x1b[7m", 4);
-                    abAppend(ab, &sym, 1);
-                    abAppend(ab, "\x1b[m", 3);
-                    if (current_color != -1)
-                    {
-                        char buf[16];
-                        int clen = snprintf(buf, sizeof(buf), "\x1b[%dm", current_color);
-                        abAppend(ab, buf, clen);
-                    }
-                }
-                else if (hl[j] == HL_NORMAL)
-                {
-                    if (current_color != -1)
-                    {
-                        abAppend(ab, "\x1b[39m", 5);
-                        current_color = -1;
-                    }
-                    abAppend(ab, &c[j], 1);
-                }
-                else
-                {
-                    int color = editorSyntaxToColor(hl[j]);
-                    if (color != current_color)
-                    {
-                        current_color = color;
-                        char buf[16];
-                        int clen = snprintf(buf, sizeof(buf), "\x1b[%dm", color);
-                        abAppend(ab, buf, clen);
-                    }
-                    abAppend(ab, &c[j], 1);
-                }
+                editorDrawFold(ab, filerow, E.screencols - cols);
+                seg = 0;
+                filerow = editorFoldNext(filerow);
             }
-            abAppend(ab, "\x1b[39m", 5);
         }
+        else
+        {
+            int cols = editorDrawRow(ab, editorRow(filerow), filerow, E.coloff);
+            editorDrawFold(ab, filerow, E.screencols - cols);
+            filerow = editorFoldNext(filerow);
+        }
+
+        abAppend(ab, "\x1b[K", 3);
+        abAppend(ab, "\r\n", 2);
+    }
+}
 
+// project search hits in place of the rows, the picked one in inverse video
+void editorDrawGrep(struct abuf *ab)
+{
+    int cols = E.screencols + (diff.enabled ? ZILO_DIFF_GUTTER : 0);
+    if (grep.sel < grep.top)
+        grep.top = grep.sel;
+    if (grep.top + E.screenrows <= grep.sel)
+        grep.top = grep.sel - E.screenrows + 1;
+    pthread_mutex_lock(&grep.lock);
+    for (int y = 0; y < E.screenrows; y++)
+    {
+        int i = grep.top + y;
+        if (i < grep.nhit)
+        {
+            struct grepHit *h = &grep.hit[i];
+            char where[64];
+            int wlen = snprintf(where, sizeof(where), ":%d: ", h->line);
+            int flen = strlen(grep.file[h->file]);
+            if (cols < flen)
+                flen = cols;
+            if (cols - flen < wlen)
+                wlen = cols - flen;
+            int tlen = strlen(h->text);
+            if (cols - flen - wlen < tlen)
+                tlen = cols - flen - wlen;
+            if (i == grep.sel)
+                abAppend(ab, "\x1b[7m", 4);
+            abAppend(ab, "\x1b[35m", 5);
+            abAppend(ab, grep.file[h->file], flen);
+            abAppend(ab, "\x1b[32m", 5);
+            abAppend(ab, where, wlen);
+            abAppend(ab, "\x1b[39m", 5);
+            abAppend(ab, h->text, tlen);
+            abAppend(ab, "\x1b[m", 3);
+        }
+        else
+        {
+            abAppend(ab, "~", 1);
+        }
         abAppend(ab, "\x1b[K", 3);
         abAppend(ab, "\r\n", 2);
     }
+    pthread_mutex_unlock(&grep.lock);
+}
+
+// the lines of the hex view from hex.top: offset, the bytes in pairs and
+// the bytes as text, the cursor's byte inverted in the column the terminal
+// cursor isn't in and the found pattern in the match color
+void editorDrawHex(struct abuf *ab)
+{
+    editorHexScroll();
+    int w = editorHexWidth();
+    int hexcol = hex.digits + 2;
+    int textcol = hexcol + w / 2 * 5 + 1;
+    for (int y = 0; y < E.screenrows; y++)
+    {
+        off_t off = hex.top + (off_t)y * w;
+        if (hex.size <= off)
+        {
+            abAppend(ab, "~\x1b[K\r\n", 6);
+            continue;
+        }
+        int n = hex.size - off < w ? hex.size - off : w;
+        char digits[2 * ZILO_HEX_WIDTH];
+        hexEncode(hex.map + off, n, digits);
+
+        // the line and a color per column, 7 for inverse
+        char line[16 + 2 + ZILO_HEX_WIDTH / 2 * 5 + 1 + ZILO_HEX_WIDTH];
+        unsigned char color[sizeof(line)];
+        int len = textcol + n;
+        snprintf(line, sizeof(line), "%0*llx", hex.digits, (long long)off);
+        memset(line + hex.digits, ' ', len - hex.digits);
+        memset(color, 0, len);
+        for (int i = 0; i < n; i++)
+        {
+            int at = hexcol + i / 2 * 5 + i % 2 * 2;
+            unsigned char b = hex.map[off + i];
+            line[at] = digits[2 * i];
+            line[at + 1] = digits[2 * i + 1];
+            line[textcol + i] = b < 32 || 127 <= b ? '.' : b;
+            int c = 0;
+            if (hex.match != -1 && hex.match <= off + i && off + i < hex.match + hex.matchlen)
+                c = editorSyntaxToColor(HL_MATCH);
+            color[at] = color[at + 1] = off + i == hex.cur && hex.ascii ? 7 : c;
+            color[textcol + i] = off + i == hex.cur && !hex.ascii ? 7 : c;
+        }
+        line[hex.digits] = ':';
+
+        if (E.screencols < len)
+            len = E.screencols;
+        for (int i = 0; i < len;)
+        {
+            int run = i + 1;
+            while (run < len && color[run] == color[i])
+                run++;
+            if (color[i])
+            {
+                char buf[16];
+                int clen = snprintf(buf, sizeof(buf), "\x1b[%dm", color[i]);
+                abAppend(ab, buf, clen);
+            }
+            abAppend(ab, &line[i], run - i);
+            if (color[i])
+                abAppend(ab, "\x1b[m", 3);
+            i = run;
+        }
+        abAppend(ab, "\x1b[K\r\n", 5);
+    }
 }
 
 void editorDrawStatusBar(struct abuf *ab)
 {
     abAppend(ab, "\x1b[7m", 4); // inverted color
     char status[80], rstatus[80];
-    int len = snprintf(status, sizeof(status),
+    int len, rlen;
+    if (hex.map)
+    {
+        len = snprintf(status, sizeof(status), "%.20s - %lld bytes %s",
+                       E.filename, (long long)hex.size, E.dirty ? "(modified)" : "");
+        rlen = snprintf(rstatus, sizeof(rstatus), "hex | %llx/%llx",
+                        (long long)hex.cur, (long long)hex.size);
+    }
+    else
+    {
+        len = snprintf(status, sizeof(status),
                        "%.20s - %d lines %s",
                        E.filename ? E.filename : "[No Name]",
                        E.numrows, E.dirty ? "(modified)" : "");
-    int rlen = snprintf(rstatus, sizeof(rstatus), "%s | %d/%d",
+        rlen = snprintf(rstatus, sizeof(rstatus), "%s | %d/%d",
                         E.syntax ? E.syntax->filetype : "no ft", E.cy + 1, E.numrows);
-    if (E.screencols < len)
-        len = E.screencols;
+    }
+    int cols = E.screencols + (diff.enabled ? ZILO_DIFF_GUTTER : 0); // the bars span the gutter too
+    if (cols < len)
+        len = cols;
     abAppend(ab, status, len);
-    while (len < E.screencols)
+    while (len < cols)
     {
-        if (E.screencols - len == rlen)
+        if (cols - len == rlen)
         {
             abAppend(ab, rstatus, rlen);
             break;
@@ -1076,17 +8009,48 @@ void editorDrawMessageBar(struct abuf *ab)
 {
     abAppend(ab, "\x1b[K", 3);
     int msglen = strlen(E.statusmsg);
-    if (E.screencols < msglen)
-        msglen = E.screencols;
+    int cols = E.screencols + (diff.enabled ? ZILO_DIFF_GUTTER : 0);
+    if (cols < msglen)
+        msglen = cols;
     if (msglen && time(NULL) - E.statusmsg_time < 5)
         abAppend(ab, E.statusmsg, msglen);
 }
 
-void editorRefreshScreen()
+void editorDrawPerfBar(struct abuf *ab)
 {
-    editorScroll();
+    // rolling histogram of recent frame times, one column per bucket
+    static const char levels[] = " .:-=+*#";
+    int hist[ZILO_PERF_BUCKETS] = {0}, most = 1;
+    long n = perf.frames < ZILO_PERF_RING ? perf.frames : ZILO_PERF_RING;
+    for (long i = 0; i < n; i++)
+        hist[perfBucket(perf.ring[i])]++;
+    for (int b = 0; b < ZILO_PERF_BUCKETS; b++)
+        if (most < hist[b])
+            most = hist[b];
+    char graph[ZILO_PERF_BUCKETS + 1];
+    for (int b = 0; b < ZILO_PERF_BUCKETS; b++)
+        graph[b] = levels[(hist[b] * (int)(sizeof(levels) - 2) + most - 1) / most];
+    graph[ZILO_PERF_BUCKETS] = '\0';
+
+    char bar[160];
+    int len = snprintf(bar, sizeof(bar),
+                       "%.2fms .1[%s]16 syn %.2f alloc %.2f rows %.2f bars %.2f wr %.2f | %dB r%d w%d drop %ld",
+                       perf.last_frame, graph, perf.last[PERF_SYNTAX], perf.last[PERF_ALLOC],
+                       perf.last[PERF_ROWS], perf.last[PERF_BARS], perf.last[PERF_WRITE],
+                       perf.last_bytes, perf.last_reads, perf.last_writes, perf.dropped);
+    if (E.screencols < len)
+        len = E.screencols;
+    abAppend(ab, bar, len);
+    abAppend(ab, "\x1b[K\r\n", 5);
+}
 
-    struct abuf ab = ABUF_INIT;
+// compose a whole frame into ab without touching the terminal
+void editorDrawScreen(struct abuf *ab)
+{
+    double start = perfStart();
+    editorScroll();
+    editorBracketMarks();
+    editorDiffSync();
 
     // escape sequence
     // - \x1b = escape
@@ -1096,21 +8060,97 @@ void editorRefreshScreen()
     // - <esc>[1K   = clear the left part of the current line from the cursor
     // - <esc>[2K   = clear the whole line
     // - <esc>[1;1H = set the cursor at the top-left of the screen
-    abAppend(&ab, "\x1b[?25l", 6);
-    abAppend(&ab, "\x1b[H", 3);
+    abAppend(ab, "\x1b[?25l", 6);
+    abAppend(ab, "\x1b[H", 3);
+
+    double t = perfStart();
+    if (grep.listing)
+        editorDrawGrep(ab);
+    else if (hex.map)
+        editorDrawHex(ab);
+    else
+        editorDrawRows(ab);
+    perfStop(PERF_ROWS, t);
+    if (perf.overlay)
+        editorDrawPerfBar(ab);
+    editorDrawStatusBar(ab);
+    editorDrawMessageBar(ab);
+
+    int y = editorFoldVisible(E.cy) - editorFoldVisible(E.rowoff);
+    int x = E.rx - E.coloff;
+    if (wrap.enabled)
+    {
+        int line = editorWrapLine(E.cy, E.rx);
+        y = editorWrapPrefix(E.cy) + line - editorWrapPrefix(E.rowoff) - E.segoff;
+        x = E.rx - editorWrapStart(E.cy, line);
+    }
+    if (diff.enabled)
+        x += ZILO_DIFF_GUTTER;
+    if (grep.listing)
+    {
+        y = grep.sel - grep.top;
+        x = 0;
+    }
+    else if (hex.map)
+    {
+        int w = editorHexWidth();
+        int i = hex.cur % w;
+        y = (hex.cur - hex.top) / w;
+        x = hex.ascii ? hex.digits + 2 + w / 2 * 5 + 1 + i : hex.digits + 2 + i / 2 * 5 + i % 2 * 2 + hex.nibble;
+    }
+    char buf[32];
+    snprintf(buf, sizeof(buf), "\x1b[%d;%dH", y + 1, x + 1);
+    abAppend(ab, buf, strlen(buf));
 
-    editorDrawRows(&ab);
-    editorDrawStatusBar(&ab);
-    editorDrawMessageBar(&ab);
+    abAppend(ab, "\x1b[?25h", 6);
+    perfStop(PERF_BARS, start);
+    perf.stage[PERF_BARS] -= perf.stage[PERF_ROWS];
+}
 
-    char buf[32];
-    snprintf(buf, sizeof(buf), "\x1b[%d;%dH", (E.cy - E.rowoff) + 1, (E.rx - E.coloff) + 1);
-    abAppend(&ab, buf, strlen(buf));
+void editorRefreshScreen()
+{
+    if (server.fd != -1 && !server.attached)
+        return;
+    if (E.nonblock && (!editorFlushOutput() || editorInputPending()))
+    {
+        // the terminal is still taking the last frame or more keys are
+        // queued, editorWaitInput draws once both have settled
+        E.stale = 1;
+        perf.dropped++;
+        return;
+    }
+    E.stale = 0;
 
-    abAppend(&ab, "\x1b[?25h", 6);
+    struct abuf ab = ABUF_INIT;
+    double start = editorNow();
+    editorDrawScreen(&ab);
+    if (server.attached)
+        editorServerDiff(&ab);
+    if (keylog.replaying && keylog.key_pending)
+    {
+        keylogSample(start - keylog.key_time, editorNow() - start, ab.len);
+    }
 
-    write(STDOUT_FILENO, ab.b, ab.len);
-    abFree(&ab);
+    double t = perfStart();
+    if (E.nonblock)
+    {
+        free(E.outbuf);
+        E.outbuf = ab.b;
+        E.outlen = ab.len;
+        E.outsent = 0;
+        editorFlushOutput();
+    }
+    else
+    {
+        if (write(STDOUT_FILENO, ab.b, ab.len) == -1 && server.attached)
+            server.lost = 1;
+        perf.writes++;
+        abFree(&ab);
+    }
+    perfStop(PERF_WRITE, t);
+    if (perf.enabled)
+        perfFrame(editorNow() - (keylog.key_pending ? keylog.key_time : start), ab.len);
+    keylog.key_pending = 0;
 }
 
 void editorSetStatusMessage(const char *fmt, ...)
@@ -1126,8 +8166,9 @@ void editorSetStatusMessage(const char *fmt, ...)
 
 char *editorPrompt(char *prompt, void (*callback)(char *, int))
 {
+    int kind = callback ? MEM_SEARCH : MEM_PROMPT;
     size_t bufsize = 128;
-    char *buf = malloc(bufsize);
+    char *buf = memRealloc(kind, NULL, bufsize);
 
     size_t buflen = 0;
     buf[0] = '\0';
@@ -1148,7 +8189,7 @@ char *editorPrompt(char *prompt, void (*callback)(char *, int))
             editorSetStatusMessage("");
             if (callback)
                 callback(buf, c);
-            free(buf);
+            memFree(kind, buf);
             return NULL;
         }
         else if (c == '\r')
@@ -1166,7 +8207,7 @@ char *editorPrompt(char *prompt, void (*callback)(char *, int))
             if (buflen == bufsize - 1)
             {
                 bufsize *= 2;
-                buf = realloc(buf, bufsize);
+                buf = memRealloc(kind, buf, bufsize);
             }
             buf[buflen++] = c;
             buf[buflen] = '\0';
@@ -1179,52 +8220,61 @@ char *editorPrompt(char *prompt, void (*callback)(char *, int))
 
 void editorMoveCursor(int key)
 {
-    erow *row = (E.numrows <= E.cy) ? NULL : &E.row[E.cy];
+    erow *row = (E.numrows <= E.cy) ? NULL : editorRow(E.cy);
 
     switch (key)
     {
     case ARROW_LEFT:
         if (E.cx != 0)
         {
-            E.cx--;
+            E.cx = editorRowPrevChar(row, E.cx);
         }
         else if (0 < E.cy)
         {
-            E.cy--;
-            E.cx = E.row[E.cy].size;
+            E.cy = editorFoldPrev(E.cy);
+            E.cx = editorRow(E.cy)->size;
         }
         break;
     case ARROW_RIGHT:
         if (row && E.cx < row->size)
         {
-            E.cx++;
+            E.cx = editorRowNextChar(row, E.cx);
         }
         else if (row && E.cx == row->size)
         {
-            E.cy++;
+            E.cy = editorFoldNext(E.cy);
             E.cx = 0;
         }
         break;
     case ARROW_UP:
-        if (E.cy != 0)
+        if (wrap.enabled)
+            editorWrapGoto(editorWrapCursor() - 1);
+        else if (E.cy != 0)
         {
-            E.cy--;
+            E.cy = editorFoldPrev(E.cy);
         }
         break;
     case ARROW_DOWN:
-        if (E.cy < E.numrows)
+        if (wrap.enabled)
+            editorWrapGoto(editorWrapCursor() + 1);
+        else if (E.cy < E.numrows)
         {
-            E.cy++;
+            E.cy = editorFoldNext(E.cy);
         }
         break;
     }
 
-    row = (E.numrows <= E.cy) ? NULL : &E.row[E.cy];
+    row = (E.numrows <= E.cy) ? NULL : editorRow(E.cy);
     int rowlen = row ? row->size : 0;
     if (rowlen < E.cx)
     {
         E.cx = rowlen;
     }
+    if (row && E.cx < rowlen)
+    {
+        // don't land inside a multibyte char
+        E.cx = editorRowPrevChar(row, editorRowNextChar(row, E.cx));
+    }
 }
 
 void editorProcessKeypress()
@@ -1232,6 +8282,11 @@ void editorProcessKeypress()
     static int quit_times = ZILO_QUIT_TIMES;
 
     int c = editorReadKey();
+    if (hex.map && editorHexKey(c))
+    {
+        quit_times = ZILO_QUIT_TIMES;
+        return;
+    }
 
     switch (c)
     {
@@ -1240,12 +8295,18 @@ void editorProcessKeypress()
         break;
 
     case CTRL_KEY('q'):
+        if (server.attached)
+        {
+            editorServerDetach(); // the buffer stays loaded for the next client
+            break;
+        }
         if (E.dirty && 0 < quit_times)
         {
             editorSetStatusMessage("WARNING!!! File has unsaved changes. Press Ctrl-Q %d more times to quit.", quit_times);
             quit_times--;
             return;
         }
+        editorDrainOutput();
         write(STDOUT_FILENO, "\x1b[2J", 4);
         write(STDOUT_FILENO, "\x1b[H", 3);
         exit(0);
@@ -1261,13 +8322,72 @@ void editorProcessKeypress()
 
     case END_KEY:
         if (E.cy < E.numrows)
-            E.cx = E.row[E.cy].size;
+            E.cx = editorRow(E.cy)->size;
         break;
 
     case CTRL_KEY('f'):
         editorFind();
         break;
 
+    case CTRL_KEY('g'):
+        editorGotoLine();
+        break;
+
+    case CTRL_KEY('t'):
+        editorShowMemory();
+        break;
+
+    case CTRL_KEY('w'):
+        editorWrapToggle();
+        break;
+
+    case CTRL_KEY('o'):
+        editorFoldToggle();
+        break;
+
+    case CTRL_KEY('b'):
+        editorBracketJump();
+        break;
+
+    case CTRL_KEY('n'):
+        editorComplete();
+        break;
+
+    case CTRL_KEY('r'):
+        editorOutline();
+        break;
+
+    case CTRL_KEY('d'):
+        editorOutlineDefinition();
+        break;
+
+    case CTRL_KEY('x'):
+        editorFilter();
+        break;
+
+    case CTRL_KEY('e'):
+        editorDiffToggle();
+        break;
+
+    case CTRL_KEY('a'):
+        editorGrep();
+        break;
+
+    case CTRL_KEY('j'):
+        editorDiffJump(1);
+        break;
+
+    case CTRL_KEY('k'):
+        editorDiffJump(-1);
+        break;
+
+    case CTRL_KEY('p'):
+        // the overlay takes a row above the status bar
+        perf.overlay = !perf.overlay;
+        perf.enabled = perf.overlay || perf.dump != NULL;
+        E.screenrows += perf.overlay ? -1 : 1;
+        break;
+
     case BACKSPACE:
     case CTRL_KEY('h'):
     case DEL_KEY:
@@ -1279,13 +8399,20 @@ void editorProcessKeypress()
     case PAGE_UP:
     case PAGE_DOWN:
     {
+        if (wrap.enabled)
+        {
+            // from the top screen line like the row walk below, in O(log n)
+            int top = editorWrapPrefix(E.rowoff) + E.segoff;
+            editorWrapGoto(c == PAGE_UP ? top - E.screenrows : top + 2 * E.screenrows - 1);
+            break;
+        }
         if (c == PAGE_UP)
         {
             E.cy = E.rowoff;
         }
         else if (c == PAGE_DOWN)
         {
-            E.cy = E.rowoff + E.screenrows - 1;
+            E.cy = editorFoldRow(editorFoldVisible(E.rowoff) + E.screenrows - 1);
             if (E.numrows < E.cy)
                 E.cy = E.numrows;
         }
@@ -1304,51 +8431,152 @@ void editorProcessKeypress()
         break;
 
     case CTRL_KEY('l'):
+        server.full = 1; // a client gets every line again
+        break;
+
     case '\x1b': // <esc>
         break;
 
     default:
+    {
+        int dirty = E.dirty;
         editorInsertChar(c);
+        if (E.dirty != dirty && editorIsWordChar(c))
+            editorCompleteHint(); // only when the char went in
         break;
     }
+    }
 
     quit_times = ZILO_QUIT_TIMES;
 }
 
 /*** init ***/
 
-void initEditor()
+// set up an empty editor with a text area of the given size, no terminal needed
+void initEditorSize(int screenrows, int screencols)
 {
     E.cx = 0;
     E.cy = 0;
     E.rx = 0;
     E.rowoff = 0;
     E.coloff = 0;
+    E.segoff = 0;
     E.numrows = 0;
+    E.rowcap = 0;
     E.row = NULL;
     E.dirty = 0;
     E.filename = NULL;
     E.statusmsg[0] = '\0';
     E.statusmsg_time = 0;
     E.syntax = NULL;
+    E.match_row = -1;
+    E.screenrows = screenrows;
+    E.screencols = screencols;
+}
 
-    if (getWindowSize(&E.screenrows, &E.screencols) == -1)
+void initEditor()
+{
+    int rows, cols;
+    if (getWindowSize(&rows, &cols) == -1)
         die("getWindowSize");
-    E.screenrows -= 2; // for status bar at the bottom of the screen
+    initEditorSize(rows - 2, cols); // for status bar at the bottom of the screen
 }
 
+// the bench harness includes this file with ZILO_NO_MAIN to drive the core headless
+#ifndef ZILO_NO_MAIN
+// usage: zilo [--record keys.log | --replay keys.log] [--perf stats.json]
+//             [--follow | --view budget-mb] [file]
+//        zilo --mem file   prints where the memory for file goes and exits
+//        zilo --attach file  edits file through a server that keeps it loaded,
+//                            starting one when there is none
+//        zilo --serve file | --stop file  runs that server here, or stops it
 int main(int argc, char *argv[])
 {
-    enableRawMode();
+    char *record = NULL, *replay = NULL;
+    int follow_file = 0;
+    int hex_file = 0;
+    long view_mb = 0;
+    int arg = 1;
+    if (argc == 3 && strcmp(argv[1], "--mem") == 0)
+    {
+        initEditorSize(22, 80);
+        editorOpen(argv[2]);
+        editorMemoryReport(stdout);
+        return 0;
+    }
+    if (argc == 3 && strcmp(argv[1], "--attach") == 0)
+        editorClient(argv[2]);
+    if (argc == 3 && strcmp(argv[1], "--serve") == 0)
+        editorServe(argv[2], editorServerPath(argv[2]));
+    if (argc == 3 && strcmp(argv[1], "--stop") == 0)
+        return editorServerStop(argv[2]);
+    while (arg < argc && strncmp(argv[arg], "--", 2) == 0)
+    {
+        if (strcmp(argv[arg], "--follow") == 0)
+        {
+            follow_file = 1;
+            arg++;
+            continue;
+        }
+        if (strcmp(argv[arg], "--hex") == 0)
+        {
+            hex_file = 1;
+            arg++;
+            continue;
+        }
+        if (argc <= arg + 1)
+            break;
+        if (strcmp(argv[arg], "--record") == 0)
+            record = argv[arg + 1];
+        else if (strcmp(argv[arg], "--replay") == 0)
+            replay = argv[arg + 1];
+        else if (strcmp(argv[arg], "--perf") == 0)
+            perf.dump = argv[arg + 1];
+        else if (strcmp(argv[arg], "--view") == 0)
+            view_mb = atol(argv[arg + 1]);
+        else
+            break;
+        arg += 2;
+    }
 
-    initEditor();
+    if (replay)
+    {
+        keylogReplay(replay);
+    }
+    else
+    {
+        enableRawMode();
+        initEditor();
+        enableNonblockingOutput();
+        if (record)
+            keylogRecord(record);
+    }
+    if (perf.dump)
+    {
+        perf.enabled = 1;
+        atexit(perfDump);
+    }
 
-    if (2 <= argc)
+    if (arg < argc)
     {
-        editorOpen(argv[1]);
+        // compressed files can't be read in place, they always decode into
+        // rows; binary ones are mapped and shown as hex
+        int compressed = editorDetectCodec(argv[arg]) != NULL;
+        if (!compressed && (hex_file || editorHexDetect(argv[arg])) && editorHex(argv[arg]))
+            follow_file = 0; // the mapping doesn't grow with the file
+        else if (0 < view_mb && !compressed)
+            editorView(argv[arg], view_mb * 1024 * 1024);
+        else
+            editorOpen(argv[arg]);
+        if (follow_file && !replay && !stream.codec && view.fd == -1)
+            editorFollow(argv[arg]);
     }
 
-    editorSetStatusMessage("HELP: Ctrl-S = save | Ctrl-Q = quit | Ctrl-F = find");
+    editorOutlineStart();
+    if (hex.map)
+        editorSetStatusMessage("HELP: Ctrl-S = save | Ctrl-Q = quit | Ctrl-F = find bytes | Ctrl-G = go to offset | Tab = hex/text");
+    else
+        editorSetStatusMessage("HELP: Ctrl-S = save | Ctrl-Q = quit | Ctrl-F = find | Ctrl-G = go to line");
 
     while (1)
     {
@@ -1357,3 +8585,4 @@ int main(int argc, char *argv[])
     }
     return 0;
 }
+#endif